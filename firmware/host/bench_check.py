@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+
+# Compares a benchmark report (see ../src/bench.c and bench_host.c) against
+# a stored baseline. Fails if
+#   - a pattern measured in target cycles exceeds the frame budget at the given fps, or
+#   - a pattern's mean cost in cycles, instructions or basic blocks grew by more than
+#     the tolerance compared to the baseline, or
+#   - a baseline is given, but none of these could be compared against it.
+# Wall clock times ("ns") depend on the load of the host. They are compared for
+# information only and never fail the check.
+#
+# The target report is simply the UART log of a 'make BENCH=1' firmware. The frame
+# budget only applies to such logs; the host reports have no cycles.
+
+import sys
+import argparse
+
+def read_report(filename):
+	rows = {}
+	for line in open(filename).readlines():
+		fields = line.strip().split("\t")
+		if line.startswith("#") or len(fields) != 6:
+			continue
+		group, name, frames, mean, maximum, unit = fields
+		try:
+			rows[(group, name, unit)] = (int(mean), int(maximum))
+		except ValueError:
+			continue
+	return rows
+
+parser = argparse.ArgumentParser()
+parser.add_argument("report")
+parser.add_argument("baseline", nargs="?")
+parser.add_argument("--fps", type=int, default=60)
+parser.add_argument("--clock", type=int, default=72000000, help="core clock in Hz, for the cycle budget")
+parser.add_argument("--tolerance", type=float, default=10, help="allowed regression of cycles/instructions/blocks in percent")
+args = parser.parse_args()
+
+report = read_report(args.report)
+baseline = read_report(args.baseline) if args.baseline else {}
+
+if not report:
+	print("%s: no benchmark results found" % args.report)
+	exit(1)
+
+budget = args.clock // args.fps
+failed = False
+compared = 0
+
+for key, (mean, maximum) in sorted(report.items()):
+	group, name, unit = key
+	status = "ok"
+
+	if unit == "cycles" and maximum > budget:
+		status = "FAIL: max %d exceeds the frame budget of %d cycles" % (maximum, budget)
+		failed = True
+	elif key in baseline:
+		base_mean = baseline[key][0]
+		change = 100. * (mean - base_mean) / max(base_mean, 1)
+		if unit == "ns":
+			status = "info: %+.0f%% against the baseline of %d" % (change, base_mean)
+		elif mean > base_mean * (1 + args.tolerance / 100):
+			status = "FAIL: mean %d is %+.0f%% above the baseline of %d" % (mean, change, base_mean)
+			failed = True
+			compared += 1
+		else:
+			compared += 1
+	else:
+		status = "ok (no baseline)"
+
+	print("%-10s %-20s %10d %10d %-6s %s" % (group, name, mean, maximum, unit, status))
+
+if baseline and not compared:
+	print("FAIL: nothing but wall clock times to compare against the baseline")
+	failed = True
+
+exit(1 if failed else 0)
@@ -0,0 +1,97 @@
+/* Host side of the pattern benchmark.
+ *
+ * Runs the same trace as the firmware's BENCH build (see ../src/bench.c), but
+ * measures wall clock nanoseconds and, if the kernel allows it, the number of
+ * retired user space instructions.
+ *
+ * Built with -DBENCH_BLOCKS and the pattern code instrumented by
+ * -fsanitize-coverage=trace-pc (build/bench_blocks), it counts the executed basic
+ * blocks instead. Unlike the time, this does not depend on the load of the host,
+ * and unlike the instructions, it needs no hardware performance counter.
+ *
+ * Usage: build/bench > bench_report.tsv
+ *        build/bench_blocks >> bench_report.tsv
+ */
+
+#define _GNU_SOURCE
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "bench.h"
+#include "noise.h"
+#include "ws2812.h"
+#include "output.h"
+
+volatile uint32_t led_data[LED_COUNT];
+
+static int perf_fd = -1;
+
+#ifdef BENCH_BLOCKS
+static uint32_t blocks = 0;
+
+/** Called by the instrumented code at the start of every basic block */
+void __sanitizer_cov_trace_pc(void);
+void __sanitizer_cov_trace_pc(void)
+{
+	blocks++;
+}
+
+static uint32_t counter_blocks(void)
+{
+	return blocks;
+}
+#endif
+
+static uint32_t counter_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t counter_instructions(void)
+{
+	uint64_t value = 0;
+	if (read(perf_fd, &value, sizeof(value)) != sizeof(value))
+		return 0;
+	return value;
+}
+
+static int open_instruction_counter(void)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+int main(void)
+{
+	output_init();
+
+#ifdef BENCH_BLOCKS
+	bench_run(counter_blocks, "blocks", 1);
+	return 0;
+#endif
+
+	printf("# group\tname\tframes\tmean\tmax\tunit\n");
+
+	bench_run(counter_ns, "ns", 10);
+
+	perf_fd = open_instruction_counter();
+	if (perf_fd >= 0)
+		bench_run(counter_instructions, "instr", 1);
+	else
+		fprintf(stderr, "bench: no instruction counter available, reporting ns only\n");
+
+	return 0;
+}
@@ -0,0 +1,438 @@
+/* Golden-frame regression harness.
+ *
+ * Renders every pattern over a ride (a synthetic one, or one recorded with a
+ * 'make RECORD_RIDE=1' firmware) and hashes each frame as the WS2812 encoder would
+ * send it, i.e. after the output stage. This allows checking that optimisations of
+ * the patterns, color.c, math.c, noise.c or output.c do not change the output.
+ *
+ * Usage:
+ *   golden hash [options]               print one FNV-1a hash per pattern
+ *   golden record DIR [options]         store all frames in DIR
+ *   golden compare DIR [options]        compare against the frames in DIR
+ *   golden quality [options]            compare the bottom patterns that render at a
+ *                                       reduced resolution against the full resolution
+ *   golden arena                        print the scratch arena needs of every pattern
+ *
+ * Options:
+ *   --ride FILE        use a recorded ride: the UART log of a 'make RECORD_RIDE=1' firmware
+ *   --frames N         number of frames of the synthetic ride (default: 6000)
+ *   --tolerance N      allowed difference per color channel (default: 0)
+ *   --max-step N       limit the spatial step of all patterns (see ledpattern_max_step)
+ *   --quality N        render at quality level N (see ledpattern_quality)
+ *
+ * compare writes DIR/<group>_<name>.diff.ppm for each mismatching pattern. Every
+ * row is one mismatching frame: the expected LEDs, the actual LEDs and their
+ * difference (amplified), left to right.
+ *
+ * quality prints, per pattern, the spatial step and the maximum and mean deviation
+ * per colour channel of the frames as sent. Together with the bench results, this
+ * is the cost/quality trade-off of the step.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "ledpattern.h"
+#include "noise.h"
+#include "ws2812.h"
+#include "output.h"
+
+volatile uint32_t led_data[LED_COUNT];
+
+#define MAX_DIFF_ROWS 1000
+
+static struct bench_input *ride;
+static int n_frames = 6000;
+static int tolerance = 0;
+
+/** A ride of stop-and-go traffic, repeating every 20 sec: push off at walking pace,
+  * accelerate, cruise with some variation, brake, stand still. */
+static void synthetic_ride(int frame, struct bench_input *in, fixed_t *pos0)
+{
+	int phase = frame % (20*FPS);
+	fixed_t velocity;
+
+	if (phase < 3*FPS) // walking pace
+		velocity = (20 << SHIFT) * phase / (3*FPS);
+	else if (phase < 8*FPS) // accelerate to 300 ledunits/sec
+		velocity = (20 << SHIFT) + ((fixed_t)280 << SHIFT) * (phase - 3*FPS) / (5*FPS);
+	else if (phase < 14*FPS) // cruise
+		velocity = (300 << SHIFT) + (40 << SHIFT) * ((phase / 15) % 5 - 2) / 2;
+	else if (phase < 17*FPS) // brake
+		velocity = ((fixed_t)300 << SHIFT) * (17*FPS - phase) / (3*FPS);
+	else
+		velocity = 0;
+
+	*pos0 += velocity / FPS;
+
+	in->t = 1000 + frame;
+	in->pos0 = *pos0;
+	in->velocity = velocity;
+	in->brightness = 1000 - 1000 * (frame % (15*FPS)) / (15*FPS);
+	in->batt_cells = 3;
+	in->batt_percent = 100 - 100 * frame / n_frames;
+	in->slow_warning = (frame % (30*FPS)) < FPS ? FPS : 0;
+}
+
+static void load_ride(const char *filename)
+{
+	FILE *f = fopen(filename, "r");
+	if (!f)
+	{
+		perror(filename);
+		exit(1);
+	}
+
+	char line[256];
+	int capacity = 1024;
+	n_frames = 0;
+	ride = malloc(capacity * sizeof(*ride));
+	while (fgets(line, sizeof(line), f))
+	{
+		unsigned long long pos0;
+		long velocity;
+		struct bench_input in = { .batt_cells = 3 };
+		if (sscanf(line, "ride %d %llx %ld %d", &in.t, &pos0, &velocity, &in.brightness) != 4)
+			continue;
+		in.pos0 = pos0;
+		in.velocity = velocity;
+		if (n_frames == capacity)
+			ride = realloc(ride, (capacity *= 2) * sizeof(*ride));
+		ride[n_frames++] = in;
+	}
+	fclose(f);
+
+	for (int i=0; i<n_frames; i++)
+		ride[i].batt_percent = 100 - 100 * i / n_frames;
+
+	if (n_frames == 0)
+	{
+		fprintf(stderr, "%s: no 'ride' lines found\n", filename);
+		exit(1);
+	}
+}
+
+static void make_synthetic_ride(void)
+{
+	fixed_t pos0 = 0;
+	ride = malloc(n_frames * sizeof(*ride));
+	for (int i=0; i<n_frames; i++)
+		synthetic_ride(i, &ride[i], &pos0);
+}
+
+/* One pattern to check. Exactly one of bottom, front is set; none means bat_empty. */
+struct pattern
+{
+	const char *group;
+	const char *name;
+	ledpattern_bottom_t bottom;
+	ledpattern_front_t front;
+	int index; // in ledpatterns_bottom or ledpatterns_front
+};
+
+static void render(const struct pattern *p, const struct bench_input *in)
+{
+	ledpattern_bottom_saturation = 1000;
+	ledpattern_brightness = in->brightness;
+	if (p->bottom)
+		p->bottom(led_data, in->t, in->pos0, in->velocity);
+	else if (p->front)
+		p->front(led_data, in->t, in->batt_cells, in->batt_percent, in->slow_warning);
+	else
+		ledpattern_bat_empty(led_data, in->t, in->batt_cells);
+}
+
+static uint64_t fnv1a(uint64_t hash, const volatile uint32_t *data, int n)
+{
+	for (int i=0; i<n; i++)
+		for (int byte=0; byte<4; byte++)
+		{
+			hash ^= (data[i] >> (8*byte)) & 0xFF;
+			hash *= 0x100000001b3ull;
+		}
+	return hash;
+}
+
+static int channel_diff(uint32_t a, uint32_t b)
+{
+	int max = 0;
+	for (int shift=0; shift<24; shift+=8)
+	{
+		int diff = abs((int)((a >> shift) & 0xFF) - (int)((b >> shift) & 0xFF));
+		if (diff > max) max = diff;
+	}
+	return max;
+}
+
+static void put_pixel(FILE *f, uint32_t grb)
+{
+	fputc((grb >> 8) & 0xFF, f);
+	fputc((grb >> 16) & 0xFF, f);
+	fputc(grb & 0xFF, f);
+}
+
+static void write_diff_strip(const char *filename, const uint32_t *expected, const uint32_t *actual, const int *rows, int n_rows)
+{
+	FILE *f = fopen(filename, "wb");
+	if (!f)
+	{
+		perror(filename);
+		return;
+	}
+
+	fprintf(f, "P6\n%d %d\n255\n", 3*LED_COUNT + 2, n_rows);
+	for (int r=0; r<n_rows; r++)
+	{
+		const uint32_t *exp = &expected[rows[r] * LED_COUNT];
+		const uint32_t *act = &actual[rows[r] * LED_COUNT];
+
+		for (int i=0; i<LED_COUNT; i++)
+			put_pixel(f, exp[i]);
+		put_pixel(f, 0xFFFFFF);
+		for (int i=0; i<LED_COUNT; i++)
+			put_pixel(f, act[i]);
+		put_pixel(f, 0xFFFFFF);
+		for (int i=0; i<LED_COUNT; i++)
+		{
+			uint32_t diff = 0;
+			for (int shift=0; shift<24; shift+=8)
+			{
+				int d = 4 * abs((int)((exp[i] >> shift) & 0xFF) - (int)((act[i] >> shift) & 0xFF));
+				diff |= (uint32_t)(d > 255 ? 255 : d) << shift;
+			}
+			put_pixel(f, diff);
+		}
+	}
+	fclose(f);
+}
+
+/** Renders all frames of the ride into frames[], returns the hash over all of them */
+static uint64_t render_all(const struct pattern *p, uint32_t *frames)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+
+	memset((void*)led_data, 0, sizeof(led_data));
+	if (p->bottom)
+		ledpattern_bottom_activate(p->index);
+	else if (p->front)
+		ledpattern_front_activate(p->index);
+	for (int i=0; i<n_frames; i++)
+	{
+		render(p, &ride[i]);
+
+		// what the encoder would send
+		output_set_bottom(ride[i].brightness, ledpattern_bottom_saturation);
+		uint32_t *frame = &frames[i*LED_COUNT];
+		for (int j=0; j<LED_COUNT; j++)
+			frame[j] = output_map_led(j, led_data[j]);
+		hash = fnv1a(hash, frame, LED_COUNT);
+	}
+	return hash;
+}
+
+static int check_pattern(const struct pattern *p, const char *mode, const char *dir)
+{
+	uint32_t *frames = malloc(n_frames * LED_COUNT * sizeof(*frames));
+	uint64_t hash = render_all(p, frames);
+	int result = 0;
+
+	char filename[1024];
+	snprintf(filename, sizeof(filename), "%s/%s_%s.frames", dir ? dir : ".", p->group, p->name);
+
+	if (!strcmp(mode, "hash"))
+	{
+		printf("%s\t%s\t%016llx\n", p->group, p->name, (unsigned long long)hash);
+	}
+	else if (!strcmp(mode, "record"))
+	{
+		FILE *f = fopen(filename, "wb");
+		if (!f || fwrite(frames, sizeof(*frames), n_frames * LED_COUNT, f) != (size_t)(n_frames * LED_COUNT))
+		{
+			perror(filename);
+			result = 1;
+		}
+		if (f) fclose(f);
+		printf("%s\t%s\t%016llx\n", p->group, p->name, (unsigned long long)hash);
+	}
+	else // compare
+	{
+		uint32_t *expected = malloc(n_frames * LED_COUNT * sizeof(*expected));
+		FILE *f = fopen(filename, "rb");
+		if (!f || fread(expected, sizeof(*expected), n_frames * LED_COUNT, f) != (size_t)(n_frames * LED_COUNT))
+		{
+			fprintf(stderr, "%s: cannot read %d frames\n", filename, n_frames);
+			result = 1;
+		}
+		else
+		{
+			static int rows[MAX_DIFF_ROWS];
+			int n_rows = 0, n_mismatch = 0, max_diff = 0;
+
+			for (int i=0; i<n_frames; i++)
+			{
+				int frame_diff = 0;
+				for (int j=0; j<LED_COUNT; j++)
+				{
+					int diff = channel_diff(expected[i*LED_COUNT + j], frames[i*LED_COUNT + j]);
+					if (diff > frame_diff) frame_diff = diff;
+				}
+				if (frame_diff > max_diff) max_diff = frame_diff;
+				if (frame_diff > tolerance)
+				{
+					n_mismatch++;
+					if (n_rows < MAX_DIFF_ROWS)
+						rows[n_rows++] = i;
+				}
+			}
+
+			if (n_mismatch)
+			{
+				snprintf(filename, sizeof(filename), "%s/%s_%s.diff.ppm", dir, p->group, p->name);
+				write_diff_strip(filename, expected, frames, rows, n_rows);
+				printf("%-10s %-20s FAIL: %d of %d frames differ by up to %d, see %s\n", p->group, p->name, n_mismatch, n_frames, max_diff, filename);
+				result = 1;
+			}
+			else
+				printf("%-10s %-20s ok (max. difference %d)\n", p->group, p->name, max_diff);
+		}
+		if (f) fclose(f);
+		free(expected);
+	}
+
+	free(frames);
+	return result;
+}
+
+/** Compares a pattern at its spatial step against the full resolution */
+static void quality_pattern(const struct pattern *p, int step)
+{
+	uint32_t *frames = malloc(n_frames * LED_COUNT * sizeof(*frames));
+	uint32_t *reference = malloc(n_frames * LED_COUNT * sizeof(*reference));
+
+	int max_step = ledpattern_max_step;
+	int quality = ledpattern_quality;
+	render_all(p, frames);
+	ledpattern_max_step = 1;
+	ledpattern_quality = 0;
+	render_all(p, reference);
+	ledpattern_max_step = max_step;
+	ledpattern_quality = quality;
+
+	int max_diff = 0;
+	long long sum_diff = 0;
+	for (int i=0; i<n_frames * LED_COUNT; i++)
+	{
+		int diff = channel_diff(reference[i], frames[i]);
+		if (diff > max_diff) max_diff = diff;
+		sum_diff += diff;
+	}
+
+	printf("%-10s %-20s step %d: max. deviation %3d, mean %.2f\n", p->group, p->name, step, max_diff,
+		(double)sum_diff / (n_frames * (2*N_BOTTOM)));
+
+	free(reference);
+	free(frames);
+}
+
+/** Prints the arena needs of every pattern, see ledpattern.h */
+static void arena_report(void)
+{
+	int max_bottom = 0, max_front = 0;
+	for (int p=0; p<N_BOTTOM_PATTERNS; p++)
+	{
+		printf("%-10s %-20s %5d bytes\n", "bottom", ledpatterns_bottom[p].name, ledpatterns_bottom[p].state_size);
+		if (ledpatterns_bottom[p].state_size > max_bottom) max_bottom = ledpatterns_bottom[p].state_size;
+	}
+	for (int p=0; p<N_FRONT_PATTERNS; p++)
+	{
+		printf("%-10s %-20s %5d bytes\n", "front", ledpatterns_front[p].name, ledpatterns_front[p].state_size);
+		if (ledpatterns_front[p].state_size > max_front) max_front = ledpatterns_front[p].state_size;
+	}
+	printf("peak: %d of %d bytes for the bottom, %d of %d for the front (host sizes)\n",
+		max_bottom, LEDPATTERN_ARENA_BOTTOM, max_front, LEDPATTERN_ARENA_FRONT);
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s hash|record DIR|compare DIR|quality|arena [--ride FILE] [--frames N] [--tolerance N] [--max-step N] [--quality N]\n", argv0);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) usage(argv[0]);
+
+	const char *mode = argv[1];
+	const char *dir = NULL;
+	const char *ride_file = NULL;
+	int argi = 2;
+
+	output_init();
+
+	if (!strcmp(mode, "record") || !strcmp(mode, "compare"))
+	{
+		if (argc < 3) usage(argv[0]);
+		dir = argv[argi++];
+	}
+	else if (!strcmp(mode, "arena"))
+	{
+		arena_report();
+		return 0;
+	}
+	else if (strcmp(mode, "hash") && strcmp(mode, "quality"))
+		usage(argv[0]);
+
+	for (; argi < argc; argi++)
+	{
+		if (!strcmp(argv[argi], "--ride") && argi+1 < argc)
+			ride_file = argv[++argi];
+		else if (!strcmp(argv[argi], "--frames") && argi+1 < argc)
+			n_frames = atoi(argv[++argi]);
+		else if (!strcmp(argv[argi], "--tolerance") && argi+1 < argc)
+			tolerance = atoi(argv[++argi]);
+		else if (!strcmp(argv[argi], "--max-step") && argi+1 < argc)
+			ledpattern_max_step = atoi(argv[++argi]);
+		else if (!strcmp(argv[argi], "--quality") && argi+1 < argc)
+			ledpattern_quality = atoi(argv[++argi]);
+		else
+			usage(argv[0]);
+	}
+
+	if (ride_file)
+		load_ride(ride_file);
+	else
+		make_synthetic_ride();
+
+	if (!strcmp(mode, "quality"))
+	{
+		for (int p=0; p<N_BOTTOM_PATTERNS; p++)
+		{
+			int step = ledpatterns_bottom[p].step;
+			if (step > 1 && ledpattern_quality >= 2)
+				step *= 2;
+			step = step < ledpattern_max_step ? step : ledpattern_max_step;
+			struct pattern pattern = { "bottom", ledpatterns_bottom[p].name, ledpatterns_bottom[p].render, NULL, p };
+			if (step > 1)
+				quality_pattern(&pattern, step);
+		}
+		return 0;
+	}
+
+	int result = 0;
+	for (int p=0; p<N_BOTTOM_PATTERNS; p++)
+	{
+		struct pattern pattern = { "bottom", ledpatterns_bottom[p].name, ledpatterns_bottom[p].render, NULL, p };
+		result |= check_pattern(&pattern, mode, dir);
+	}
+	for (int p=0; p<N_FRONT_PATTERNS; p++)
+	{
+		struct pattern pattern = { "front", ledpatterns_front[p].name, NULL, ledpatterns_front[p].render, p };
+		result |= check_pattern(&pattern, mode, dir);
+	}
+	struct pattern bat_empty = { "bat_empty", "bat_empty", NULL, NULL, 0 };
+	result |= check_pattern(&bat_empty, mode, dir);
+
+	return result;
+}
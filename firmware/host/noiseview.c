@@ -0,0 +1,103 @@
+/* Compares the visual character of the value noise (noise.c: fractal_noise) and
+ * the gradient noise (noise.c: gnoise_row).
+ *
+ * Prints the spread, the smoothness in space and time, and the correlation with
+ * the same row one value noise period (64 units) later, which shows the
+ * repetition. Writes noise_value.ppm and noise_gradient.ppm: the lava pattern's
+ * hue noise for N_BOTTOM LEDs (x axis, magnified) over 1200 frames (y axis).
+ *
+ * Usage: build/noiseview [OUTDIR]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "noise.h"
+
+#define LEDS 26
+#define FRAMES 1200
+#define ZOOM 8
+#define PERIOD_FRAMES (64*60) // the value noise lattice's period at y = t/60
+
+struct stats { double sum, sum2, dx, dt, corr_ab, corr_a2, corr_b2; int n; };
+
+static void account(struct stats *s, const double *row, const double *prev_row, const double *later_row)
+{
+	for (int i=0; i<LEDS; i++)
+	{
+		s->sum += row[i];
+		s->sum2 += row[i] * row[i];
+		if (i > 0) s->dx += fabs(row[i] - row[i-1]);
+		s->dt += fabs(row[i] - prev_row[i]);
+		s->corr_ab += row[i] * later_row[i];
+		s->corr_a2 += row[i] * row[i];
+		s->corr_b2 += later_row[i] * later_row[i];
+		s->n++;
+	}
+}
+
+static void print_stats(const char *name, const struct stats *s)
+{
+	double mean = s->sum / s->n;
+	printf("%-10s mean %+.3f  sd %.3f  mean |dx| %.4f  mean |dt| %.4f  correlation after 64 units %+.3f\n",
+		name, mean, sqrt(s->sum2 / s->n - mean * mean),
+		s->dx / s->n, s->dt / s->n, s->corr_ab / sqrt(s->corr_a2 * s->corr_b2));
+}
+
+static void value_row(double *row, int t)
+{
+	for (int i=0; i<LEDS; i++)
+		row[i] = fractal_noise((((fixed_t)i)<<SHIFT) / 7, (((fixed_t)t)<<SHIFT) / 60, ONE/2, ONE/4, ONE/8) / (double)ONE;
+}
+
+static void gradient_row(double *row, int t)
+{
+	int32_t values[LEDS];
+	gnoise_row(values, LEDS, 0, ONE / 7, (((fixed_t)t)<<SHIFT) / 60, 3);
+	for (int i=0; i<LEDS; i++)
+		row[i] = values[i] / (double)ONE;
+}
+
+static void run(const char *name, void (*row_fn)(double *, int), const char *filename)
+{
+	FILE *f = fopen(filename, "wb");
+	if (!f)
+	{
+		perror(filename);
+		exit(1);
+	}
+	fprintf(f, "P5\n%d %d\n255\n", LEDS * ZOOM, FRAMES);
+
+	struct stats s = {0};
+	double row[LEDS], prev_row[LEDS], later_row[LEDS];
+	row_fn(prev_row, 0);
+	for (int t=1; t<=FRAMES; t++)
+	{
+		row_fn(row, t);
+		row_fn(later_row, t + PERIOD_FRAMES);
+		account(&s, row, prev_row, later_row);
+		for (int i=0; i<LEDS; i++)
+		{
+			int gray = 128 + row[i] * 127;
+			gray = gray < 0 ? 0 : gray > 255 ? 255 : gray;
+			for (int z=0; z<ZOOM; z++)
+				fputc(gray, f);
+			prev_row[i] = row[i];
+		}
+	}
+	fclose(f);
+	print_stats(name, &s);
+}
+
+int main(int argc, char **argv)
+{
+	const char *dir = argc > 1 ? argv[1] : ".";
+	char filename[1024];
+
+	snprintf(filename, sizeof(filename), "%s/noise_value.ppm", dir);
+	run("value", value_row, filename);
+	snprintf(filename, sizeof(filename), "%s/noise_gradient.ppm", dir);
+	run("gradient", gradient_row, filename);
+	return 0;
+}
@@ -0,0 +1,78 @@
+/* Simulates a 1000 km ride through the odometer (../src/odometer.c) and checks
+ * every frame against the exact position, computed with 128 bit integers.
+ *
+ * The speed varies between standstill and 60 km/h. Fails if the position is
+ * ever off by more than MAX_ERROR, goes backwards, or jumps.
+ *
+ * Usage: build/odometer_sim [km]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "odometer.h"
+
+#define WHEEL_RADIUS_MM 105.
+#define LED_DISTANCE_MM 17.5
+#define MAX_ERROR 2 // in 1/65536 ledunits
+
+int main(int argc, char **argv)
+{
+	double km = argc > 1 ? atof(argv[1]) : 1000;
+
+	const double circumference_mm = WHEEL_RADIUS_MM * 2 * 3.141592654;
+	const fixed_t circumference = (1<<SHIFT) * circumference_mm / LED_DISTANCE_MM;
+	const uint64_t total_revolutions = km * 1e6 / circumference_mm;
+	const uint32_t max_millihertz = 60 / 3.6 * 1000. / circumference_mm * FREQUENCY_FACTOR; // 60 km/h
+
+	struct odometer odo;
+	odometer_init(&odo, circumference);
+
+	unsigned __int128 phase_sum = 0; // exact: sum of all frequencies
+	int old_distance = 0; // the accumulator the firmware used to have, for comparison
+	uint64_t old_overflow_frame = 0;
+	fixed_t last_pos = 0;
+	int max_error = 0;
+	uint64_t frame = 0;
+	uint32_t frequency = 0;
+	srand(42);
+
+	while (odo.revolutions < total_revolutions)
+	{
+		// a new target speed every 10 seconds, approached smoothly; sometimes a stop
+		if (frame % (10*FPS) == 0)
+			frequency = (rand() % 8 == 0) ? 0 : rand() % max_millihertz;
+
+		odometer_advance(&odo, frequency);
+		phase_sum += frequency;
+
+		if (!old_overflow_frame && old_distance > (int)(0x7FFFFFFF - frequency))
+			old_overflow_frame = frame;
+		else if (!old_overflow_frame)
+			old_distance += frequency;
+
+		fixed_t pos = odometer_position(&odo);
+		fixed_t exact = phase_sum * circumference / ODOMETER_PHASE_PER_REV;
+		int error = llabs(pos - exact);
+		if (error > max_error)
+			max_error = error;
+
+		if (error > MAX_ERROR || pos < last_pos || pos - last_pos > circumference)
+		{
+			printf("FAIL at frame %llu (%.3f km): position %lld, expected %lld, last %lld\n",
+				(unsigned long long)frame, odo.revolutions * circumference_mm / 1e6,
+				(long long)pos, (long long)exact, (long long)last_pos);
+			return 1;
+		}
+
+		last_pos = pos;
+		frame++;
+	}
+
+	printf("ok: %.0f km, %llu frames (%.1f h), %lu revolutions, max. error %d/65536 ledunits\n",
+		km, (unsigned long long)frame, frame / (FPS * 3600.), (unsigned long)odo.revolutions, max_error);
+	if (old_overflow_frame)
+		printf("    (the former int accumulator overflowed after %.1f km)\n",
+			(double)old_distance / ODOMETER_PHASE_PER_REV * circumference_mm / 1e6);
+	return 0;
+}
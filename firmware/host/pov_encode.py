@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+
+# Converts an image into a POV image for ../src/pov.c. The image must be a
+# binary PPM (P6), 2 pixels high: the top row is shown by the first bottom
+# strip, the bottom row by the second one. Every column covers 1/4 of the LED
+# spacing (POV_PIXELS_PER_LED), i.e. about 4.4 mm of road. At most 16 colours.
+#
+# Usage: python3 pov_encode.py image.ppm name > image.c
+
+import sys
+import argparse
+
+def read_ppm(filename):
+	data = open(filename, "rb").read()
+	fields = []
+	pos = 0
+	while len(fields) < 4:
+		while data[pos:pos+1].isspace():
+			pos += 1
+		if data[pos:pos+1] == b"#":
+			pos = data.index(b"\n", pos)
+			continue
+		start = pos
+		while not data[pos:pos+1].isspace():
+			pos += 1
+		fields.append(data[start:pos])
+	if fields[0] != b"P6" or int(fields[3]) != 255:
+		sys.exit("%s: only 8 bit binary PPM (P6) is supported" % filename)
+	width, height = int(fields[1]), int(fields[2])
+	pixels = data[pos+1:]
+	rgb = lambda i: tuple(pixels[3*i:3*i+3])
+	return width, height, [[rgb(y * width + x) for x in range(width)] for y in range(height)]
+
+parser = argparse.ArgumentParser()
+parser.add_argument("image")
+parser.add_argument("name")
+args = parser.parse_args()
+
+width, height, rows = read_ppm(args.image)
+if height != 2:
+	sys.exit("the image must be 2 pixels high, one row per bottom strip")
+if width > 65535:
+	sys.exit("the image is too wide")
+
+palette = []
+def index(color):
+	if color not in palette:
+		palette.append(color)
+	return palette.index(color)
+
+columns = [index(rows[0][x]) << 4 | index(rows[1][x]) for x in range(width)]
+if len(palette) > 16:
+	sys.exit("the image has %d colours, at most 16 are supported" % len(palette))
+
+runs = []
+for colors in columns:
+	if runs and runs[-1][1] == colors and runs[-1][0] < 255:
+		runs[-1][0] += 1
+	else:
+		runs.append([1, colors])
+
+print("static const struct pov_run %s_runs[] = {" % args.name)
+for length, colors in runs:
+	print("\t{ %d, 0x%02x }," % (length, colors))
+print("};")
+print()
+print("const struct pov_image pov_image_%s = {" % args.name)
+print("\t.width = %d," % width)
+print("\t.n_runs = sizeof(%s_runs) / sizeof(*%s_runs)," % (args.name, args.name))
+print("\t.runs = %s_runs," % args.name)
+print("\t.palette = { %s }" % ", ".join("0x%02x%02x%02x" % (g, r, b) for r, g, b in palette))
+print("};")
+print("// %d columns in %d runs, %d bytes" % (width, len(runs), 2 * len(runs)), file=sys.stderr)
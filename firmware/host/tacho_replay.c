@@ -0,0 +1,302 @@
+/* Replays tacho edges through the estimator (../src/tacho_estimator.c) and
+ * reports how well it follows the wheel, so changes to it can be compared.
+ *
+ * The edges come from a synthetic ride, or from the trace of a 'make TACHO_TRACE=1'
+ * firmware: send "trace" via UART after a ride and save the output (see
+ * ../src/tachotrace.h).
+ *
+ * Usage:
+ *   build/tacho_replay [options]          synthetic ride
+ *   build/tacho_replay --trace LOG        recorded ride
+ *
+ * Options of the synthetic ride:
+ *   --magnets N     number of magnets (default: 5)
+ *   --misplace P    every magnet is off its nominal position by up to P permille of
+ *                   the gap (default: 100). The distances are calibrated to it.
+ *   --jitter US     every edge is up to US microseconds late (default: 20)
+ *   --speed KMH     speed at the start (default: 15)
+ *   --accel MS2     acceleration in m/s^2, negative to brake (default: 0)
+ *   --seconds S     length of the ride (default: 20)
+ *   --seed N        seed for the misplacement and the jitter (default: 1)
+ * Options of the recorded ride:
+ *   --sensor N      the sensor to replay (default: 0)
+ *
+ * Reports:
+ *   phase lock   the edge from which on the estimator's phase is always right.
+ *                Recorded rides: from which on it agrees with the firmware's.
+ *   speed error  |estimate - truth| / truth after the lock, in permille. The truth
+ *                is the wheel's frequency at the edge (synthetic), or the mean over
+ *                the last revolution (recorded, which lags when accelerating).
+ *   per edge     host time per tacho_estimator_edge()
+ * A recorded ride also reports on how many edges the replay and the firmware agree.
+ * Exits with 1 if the phase never locks.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "tacho_estimator.h"
+
+#define WHEEL_RADIUS_MM 105.
+#define MAX_EDGES 200000
+#define COST_EDGES 2000000 // edges to time for the per edge cost
+
+struct edge
+{
+	uint32_t interval;    // microseconds since the previous edge, 0 after a standstill
+	int phase;            // the right phase, or the firmware's for a recorded ride
+	uint32_t truth;       // wheel frequency in millihertz, 0 if unknown
+	uint32_t recorded;    // the firmware's estimate, recorded rides only
+};
+
+static struct edge edges[MAX_EDGES];
+static int n_edges = 0;
+static uint32_t distances[TACHO_MAX_MAGNETS];
+static int n_magnets = 5;
+static int n_overflows = 0;
+static int recorded = 0;
+
+/** Distance (see learn.py) of a gap covering `fraction` of a revolution */
+static uint32_t fraction_to_distance(double fraction)
+{
+	return fraction * n_magnets * 1e9 * TACHO_CALIB_CYCLES_PER_US / TACHO_CALIB_PRESCALER;
+}
+
+static void make_synthetic_ride(int misplace, int jitter, double kmh, double accel, double seconds, int seed)
+{
+	const double circumference_m = WHEEL_RADIUS_MM * 2 * 3.141592654 / 1000;
+	double pos[TACHO_MAX_MAGNETS + 1];
+
+	srand(seed);
+	for (int k=0; k<n_magnets; k++)
+		pos[k] = (k + (rand() % (2*misplace + 1) - misplace) / 1000.) / n_magnets;
+	pos[n_magnets] = pos[0] + 1;
+	for (int k=0; k<n_magnets; k++)
+		distances[k] = fraction_to_distance(pos[k+1] - pos[k]);
+
+	// integrate the wheel angle (in revolutions) in steps of 10us
+	const double dt = 1e-5;
+	double angle = pos[0] - 1e-9, t = 0, last_edge = -1;
+	long revolution = 0;
+	int next = 0;
+	while (t < seconds && n_edges < MAX_EDGES)
+	{
+		double speed = kmh / 3.6 + accel * t;
+		if (speed <= 0)
+			break;
+		double frequency = speed / circumference_m;
+		double next_angle = angle + frequency * dt;
+		double target = revolution + pos[next];
+		if (next_angle >= target)
+		{
+			double at = t + (target - angle) / frequency + (rand() % (jitter + 1)) * 1e-6;
+			if (last_edge >= 0)
+			{
+				edges[n_edges].interval = lround((at - last_edge) * 1e6);
+				edges[n_edges].phase = (next + n_magnets - 1) % n_magnets;
+				edges[n_edges].truth = frequency * 1000;
+				n_edges++;
+			}
+			last_edge = at;
+			if (++next == n_magnets)
+			{
+				next = 0;
+				revolution++;
+			}
+		}
+		angle = next_angle;
+		t += dt;
+	}
+}
+
+static void load_trace(const char *filename, int sensor)
+{
+	FILE *f = fopen(filename, "r");
+	if (!f)
+	{
+		perror(filename);
+		exit(1);
+	}
+
+	char line[512];
+	n_magnets = 0;
+	while (fgets(line, sizeof(line), f) && n_edges < MAX_EDGES)
+	{
+		const char *p = strstr(line, "trace ");
+		int s, phase, length;
+		unsigned long interval, frequency;
+		if (!p)
+			continue;
+		if (sscanf(p, "trace distances %d%n", &s, &length) == 1 && s == sensor)
+		{
+			p += length;
+			unsigned long d;
+			while (n_magnets < TACHO_MAX_MAGNETS && sscanf(p, "%lu%n", &d, &length) == 1)
+			{
+				distances[n_magnets++] = d;
+				p += length;
+			}
+		}
+		else if (sscanf(p, "trace edge %d %lu %lu %d", &s, &interval, &frequency, &phase) == 4 && s == sensor)
+		{
+			edges[n_edges].interval = interval;
+			edges[n_edges].phase = phase;
+			edges[n_edges].recorded = frequency;
+			n_edges++;
+		}
+		else if (!strncmp(p, "trace overflow", 14))
+			n_overflows++;
+	}
+	fclose(f);
+
+	if (n_magnets == 0 || n_edges == 0)
+	{
+		fprintf(stderr, "%s: no distances or edges of sensor %d\n", filename, sensor);
+		exit(1);
+	}
+
+	// the truth is the mean frequency over the last revolution
+	uint32_t revolution = 0;
+	int valid = 0;
+	for (int i=0; i<n_edges; i++)
+	{
+		revolution += edges[i].interval;
+		valid = edges[i].interval ? valid + 1 : 0;
+		if (i >= n_magnets)
+			revolution -= edges[i - n_magnets].interval;
+		edges[i].truth = valid >= n_magnets ? 1000000000ull / revolution : 0;
+	}
+}
+
+/** Feeds all edges to an estimator. Stores its phase and frequency per edge. */
+static void replay(int phase[], uint32_t frequency[])
+{
+	struct tacho_estimator est;
+	tacho_estimator_init(&est, distances, n_magnets);
+
+	uint32_t now = 1000000;
+	tacho_estimator_edge(&est, now);
+	for (int i=0; i<n_edges; i++)
+	{
+		if (edges[i].interval == 0)
+		{
+			// a standstill: let the estimator time out
+			now += TACHO_TIMEOUT_US;
+			tacho_estimator_frequency(&est, now);
+		}
+		now += edges[i].interval;
+		tacho_estimator_edge(&est, now);
+		phase[i] = est.phase;
+		frequency[i] = est.frequency_millihertz;
+	}
+}
+
+static double edge_cost_ns(void)
+{
+	struct tacho_estimator est;
+	struct timespec start, end;
+	uint32_t now = 1000000;
+	int n = 0;
+
+	tacho_estimator_init(&est, distances, n_magnets);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (n < COST_EDGES)
+		for (int i=0; i<n_edges; i++, n++)
+			tacho_estimator_edge(&est, now += edges[i].interval ? edges[i].interval : 1);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / n;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [--trace LOG [--sensor N]] [--magnets N] [--misplace P] [--jitter US] "
+		"[--speed KMH] [--accel MS2] [--seconds S] [--seed N]\n", argv0);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *trace = NULL;
+	int sensor = 0, misplace = 100, jitter = 20, seed = 1;
+	double kmh = 15, accel = 0, seconds = 20;
+
+	for (int argi=1; argi < argc; argi++)
+	{
+		if (argi+1 >= argc)
+			usage(argv[0]);
+		else if (!strcmp(argv[argi], "--trace"))
+			trace = argv[++argi];
+		else if (!strcmp(argv[argi], "--sensor"))
+			sensor = atoi(argv[++argi]);
+		else if (!strcmp(argv[argi], "--magnets"))
+			n_magnets = atoi(argv[++argi]);
+		else if (!strcmp(argv[argi], "--misplace"))
+			misplace = atoi(argv[++argi]);
+		else if (!strcmp(argv[argi], "--jitter"))
+			jitter = atoi(argv[++argi]);
+		else if (!strcmp(argv[argi], "--speed"))
+			kmh = atof(argv[++argi]);
+		else if (!strcmp(argv[argi], "--accel"))
+			accel = atof(argv[++argi]);
+		else if (!strcmp(argv[argi], "--seconds"))
+			seconds = atof(argv[++argi]);
+		else if (!strcmp(argv[argi], "--seed"))
+			seed = atoi(argv[++argi]);
+		else
+			usage(argv[0]);
+	}
+	if (n_magnets < 2 || n_magnets > TACHO_MAX_MAGNETS)
+		usage(argv[0]);
+
+	recorded = trace != NULL;
+	if (recorded)
+		load_trace(trace, sensor);
+	else
+		make_synthetic_ride(misplace, jitter, kmh, accel, seconds, seed);
+
+	static int phase[MAX_EDGES];
+	static uint32_t frequency[MAX_EDGES];
+	replay(phase, frequency);
+
+	// the lock is the first edge from which on the phase is always right. Phases with
+	// equal distances are equally right, e.g. all of them without misplacement.
+	int lock = n_edges;
+	while (lock > 0 && distances[phase[lock-1]] == distances[edges[lock-1].phase])
+		lock--;
+	uint64_t lock_us = 0;
+	for (int i=0; i<lock; i++)
+		lock_us += edges[i].interval;
+
+	double error_sum = 0;
+	int error_max = 0, n_errors = 0, agree = 0;
+	for (int i=lock; i<n_edges; i++)
+	{
+		if (recorded && frequency[i] == edges[i].recorded)
+			agree++;
+		if (!edges[i].truth)
+			continue;
+		int error = llabs(((int64_t)frequency[i] - edges[i].truth) * 1000 / edges[i].truth);
+		error_sum += error;
+		n_errors++;
+		if (error > error_max)
+			error_max = error;
+	}
+
+	printf("edges:       %d, %d magnets, %d overflows\n", n_edges, n_magnets, n_overflows);
+	if (lock == n_edges)
+		printf("phase lock:  never\n");
+	else
+		printf("phase lock:  after %d edges (%.2f s)\n", lock, lock_us / 1e6);
+	if (recorded)
+		printf("firmware:    %d of %d edges after the lock agree\n", agree, n_edges - lock);
+	if (n_errors)
+		printf("speed error: mean %.1f, max %d permille\n", error_sum / n_errors, error_max);
+	printf("per edge:    %.0f ns\n", edge_cost_ns());
+
+	return lock == n_edges;
+}
@@ -0,0 +1,95 @@
+/* Runs pattern programs (../src/vm.h) whose values overflow on purpose and
+ * checks that they wrap around the 32 bit range as documented. The Makefile
+ * builds the VM with -fsanitize=undefined, so any signed overflow in the
+ * interpreter aborts instead of passing by chance.
+ *
+ * Also checks that POS continues seamlessly across its wrap: sin((pos + 0.3) / 13)
+ * just before and after 32768, 65536 and 196608 LED units.
+ *
+ * Usage: build/vm_overflow
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "vm.h"
+#include "ws2812.h"
+
+/* the bottom LED that vm_run() writes for I = 0 */
+#define LED0 (N_SIDE+N_FRONT+N_SIDE+N_BOTTOM)
+
+#define K(x) VM_CONST, (uint8_t)(x), (uint8_t)((x) >> 8), (uint8_t)((x) >> 16), (uint8_t)((x) >> 24)
+#define OPK(op, x) op, (uint8_t)(x), (uint8_t)((x) >> 8), (uint8_t)((x) >> 16), (uint8_t)((x) >> 24)
+
+struct test
+{
+	const char *name;
+	uint8_t code[32]; // LED section, the frame section is empty
+	int length;
+	uint32_t expected; // low 24 bits of the result
+};
+
+#define TEST(name, expected, ...) { name, { __VA_ARGS__ }, sizeof((uint8_t[]){ __VA_ARGS__ }), (expected) & 0xFFFFFF }
+
+static const struct test tests[] = {
+	TEST("add", 0x80123456u, K(0x7FFFFFFFu), K(0x00123457u), VM_ADD),
+	TEST("sub", 0x7FEDCBA9u, K(0x80000000u), K(0x00123457u), VM_SUB),
+	TEST("addk", 0x80110000u, K(0x7FFF0000u), OPK(VM_ADDK, 0x00120000u)),
+	TEST("neg", 0x80123456u, K(0x80000000u), VM_NEG, OPK(VM_ADDK, 0x00123456u)),
+	TEST("abs", 0x80123456u, K(0x80000000u), VM_ABS, OPK(VM_ADDK, 0x00123456u)),
+	// head + len beyond the 32 bit range, x in the middle of the snake
+	TEST("snake", 0x00010000u, K(0x7FFFFFFFu), K(0x7FFEFFFFu), K(0x00020000u), K(0x00010000u), VM_SNAKE),
+};
+
+static volatile uint32_t leds[LED_COUNT];
+
+static uint32_t run(const uint8_t *code, int length, fixed_t pos0)
+{
+	uint8_t program[VM_MAX_PROGRAM] = { 'V', VM_VERSION, 0, 0, length, 0 };
+	for (int i=0; i<length; i++)
+		program[VM_HEADER + i] = code[i];
+
+	const char *error = vm_check(program, VM_HEADER + length);
+	if (error)
+	{
+		fprintf(stderr, "vm_check: %s\n", error);
+		exit(1);
+	}
+	vm_run(program, leds, 0, pos0, 0, 1000);
+	return leds[LED0];
+}
+
+int main(void)
+{
+	int result = 0;
+
+	for (unsigned i=0; i<sizeof(tests)/sizeof(*tests); i++)
+	{
+		uint32_t value = run(tests[i].code, tests[i].length, 0);
+		printf("%-8s %06lx", tests[i].name, (unsigned long)value);
+		if (value != tests[i].expected)
+		{
+			printf(" FAIL: expected %06lx", (unsigned long)tests[i].expected);
+			result = 1;
+		}
+		printf("\n");
+	}
+
+	// sin((pos + 0.3) / 13) + 2, positive so that the low 24 bits are the value
+	const uint8_t wave[] = { VM_POS, OPK(VM_ADDK, 0x00004CCCu), OPK(VM_MULK, 0x000013B1u), VM_SIN, OPK(VM_ADDK, 0x00020000u) };
+	const fixed_t wraps[] = { (fixed_t)32768 << SHIFT, (fixed_t)65536 << SHIFT, (fixed_t)3*65536 << SHIFT };
+	for (unsigned i=0; i<sizeof(wraps)/sizeof(*wraps); i++)
+	{
+		int32_t before = run(wave, sizeof(wave), wraps[i] - 1);
+		int32_t after = run(wave, sizeof(wave), wraps[i]);
+		printf("pos %6ld %06lx %06lx", (long)(wraps[i] >> SHIFT), (unsigned long)before, (unsigned long)after);
+		if (abs(after - before) > ONE/256)
+		{
+			printf(" FAIL: jumps");
+			result = 1;
+		}
+		printf("\n");
+	}
+
+	return result;
+}
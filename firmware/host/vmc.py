@@ -0,0 +1,355 @@
+#!/usr/bin/env python3
+
+# Compiles a bottom pattern written as expressions into bytecode for the pattern
+# VM (see ../src/vm.h).
+#
+# A program is a list of assignments, one per line; the last one must assign the
+# LED's colour to `color`. '#' starts a comment. All numbers are 16.16 fixed point.
+#
+#   x = pos + i
+#   wave = sin(x / 13 + t / 4)
+#   color = scale(palette(rainbow, wave / 4 + t / 20), 0.5 + wave / 2)
+#
+# Inputs:    i (LED, 0 at the rear), t (seconds), pos (LED units), velocity
+#            (LED units per second), brightness (0..1)
+# Operators: + - * / and unary -
+# Functions: sin(x) (period 1), noise(x, y), snake(x, head, len, fade), frac(x),
+#            clamp(x) (to 0..1), abs(x), min(a, b), max(a, b),
+#            hsv(h, s, v) (h in turns), palette(rainbow|lava|water, x), scale(color, v)
+#
+# Everything that does not depend on i is computed once per frame and kept in a
+# register; values used more than once are computed once. Constants are folded,
+# divisions by constants become multiplications.
+#
+# Usage:
+#   python3 vmc.py effect.txt                 print the upload command for slot 0
+#   python3 vmc.py effect.txt --slot 1        ... for slot 1
+#   python3 vmc.py effect.txt --c NAME        print a C array
+#   python3 vmc.py effect.txt --list          also print the bytecode, to stderr
+#   python3 vmc.py effect.txt --port /dev/ttyUSB0   upload (needs pyserial)
+
+import re
+import sys
+import argparse
+
+VERSION = 1
+MAX_PROGRAM = 256
+STACK = 16
+REGS = 16
+SHIFT = 16
+ONE = 1 << SHIFT
+
+# keep in sync with enum vm_op in vm.h
+OPS = ["I", "T", "POS", "VEL", "BRIGHT", "CONST", "LOAD", "STORE",
+	"ADD", "SUB", "MUL", "DIV", "MIN", "MAX", "ADDK", "MULK",
+	"NEG", "ABS", "FRAC", "CLAMP", "SIN", "NOISE", "SNAKE",
+	"HSV", "PALETTE", "SCALE"]
+OP = {name: code for code, name in enumerate(OPS)}
+OPERAND = {"CONST": 4, "ADDK": 4, "MULK": 4, "LOAD": 1, "STORE": 1, "PALETTE": 1}
+STACK_EFFECT = {"I": 1, "T": 1, "POS": 1, "VEL": 1, "BRIGHT": 1, "CONST": 1, "LOAD": 1, "STORE": -1,
+	"ADD": -1, "SUB": -1, "MUL": -1, "DIV": -1, "MIN": -1, "MAX": -1, "NOISE": -1, "SCALE": -1,
+	"SNAKE": -3, "HSV": -2}
+
+INPUTS = {"i": "I", "t": "T", "pos": "POS", "velocity": "VEL", "brightness": "BRIGHT"}
+PALETTES = {"rainbow": 0, "lava": 1, "water": 2}
+FUNCTIONS = {"sin": ("SIN", 1), "noise": ("NOISE", 2), "snake": ("SNAKE", 4), "frac": ("FRAC", 1),
+	"clamp": ("CLAMP", 1), "abs": ("ABS", 1), "min": ("MIN", 2), "max": ("MAX", 2),
+	"hsv": ("HSV", 3), "scale": ("SCALE", 2), "palette": ("PALETTE", 2)}
+BINARY = {"+": "ADD", "-": "SUB", "*": "MUL", "/": "DIV"}
+
+class CompileError(Exception):
+	pass
+
+# --- parser. Expressions become tuples: ("num", value), ("in", op), ("op", op, args...)
+
+def tokenize(text):
+	tokens = re.findall(r"\d+\.?\d*|\.\d+|[A-Za-z_]\w*|[-+*/(),=]|\S", text)
+	return tokens
+
+class Parser:
+	def __init__(self, tokens, variables):
+		self.tokens = tokens
+		self.pos = 0
+		self.variables = variables
+
+	def peek(self):
+		return self.tokens[self.pos] if self.pos < len(self.tokens) else None
+
+	def take(self, expected=None):
+		token = self.peek()
+		if token is None or (expected is not None and token != expected):
+			raise CompileError("expected %s, got %s" % (expected or "more", token or "end of line"))
+		self.pos += 1
+		return token
+
+	def expr(self):
+		node = self.term()
+		while self.peek() in ("+", "-"):
+			node = ("op", BINARY[self.take()], node, self.term())
+		return node
+
+	def term(self):
+		node = self.unary()
+		while self.peek() in ("*", "/"):
+			node = ("op", BINARY[self.take()], node, self.unary())
+		return node
+
+	def unary(self):
+		if self.peek() == "-":
+			self.take()
+			return ("op", "NEG", self.unary())
+		return self.atom()
+
+	def atom(self):
+		token = self.take()
+		if token == "(":
+			node = self.expr()
+			self.take(")")
+			return node
+		if re.match(r"[\d.]", token):
+			return ("num", to_fixed(float(token)))
+		if not re.match(r"[A-Za-z_]", token):
+			raise CompileError("unexpected %s" % token)
+		if self.peek() == "(":
+			return self.call(token)
+		if token in INPUTS:
+			return ("in", INPUTS[token])
+		if token in self.variables:
+			return self.variables[token]
+		raise CompileError("unknown name %s" % token)
+
+	def call(self, name):
+		if name not in FUNCTIONS:
+			raise CompileError("unknown function %s" % name)
+		op, n_args = FUNCTIONS[name]
+		self.take("(")
+		args = []
+		if name == "palette":
+			palette = self.take()
+			if palette not in PALETTES:
+				raise CompileError("unknown palette %s, use one of %s" % (palette, ", ".join(PALETTES)))
+			args.append(("palette", PALETTES[palette]))
+			self.take(",")
+		while True:
+			args.append(self.expr())
+			if self.peek() != ",":
+				break
+			self.take(",")
+		self.take(")")
+		if len(args) != n_args:
+			raise CompileError("%s takes %d arguments" % (name, n_args))
+		return ("op", op) + tuple(args)
+
+def to_fixed(value):
+	return wrap(int(round(value * ONE)))
+
+def wrap(value):
+	return (value + 2**31) % 2**32 - 2**31
+
+def parse(text):
+	variables = {}
+	for number, line in enumerate(text.splitlines(), 1):
+		line = line.split("#")[0].strip()
+		if not line:
+			continue
+		try:
+			tokens = tokenize(line)
+			if len(tokens) < 3 or tokens[1] != "=" or not re.match(r"[A-Za-z_]\w*$", tokens[0]):
+				raise CompileError("expected: name = expression")
+			if tokens[0] in INPUTS or tokens[0] in FUNCTIONS:
+				raise CompileError("%s is reserved" % tokens[0])
+			parser = Parser(tokens[2:], variables)
+			variables[tokens[0]] = parser.expr()
+			if parser.peek() is not None:
+				raise CompileError("unexpected %s" % parser.peek())
+		except CompileError as e:
+			raise CompileError("line %d: %s" % (number, e))
+		last = tokens[0]
+	if not variables or last != "color":
+		raise CompileError("the last line must assign color")
+	return variables["color"]
+
+# --- optimizer
+
+def fold(node):
+	"""Folds constant arithmetic, with the VM's fixed point semantics"""
+	if node[0] != "op":
+		return node
+	args = [fold(a) for a in node[2:]]
+	op = node[1]
+	values = [a[1] for a in args if a[0] == "num"]
+	if len(values) == len(args):
+		if op == "ADD": return ("num", wrap(values[0] + values[1]))
+		if op == "SUB": return ("num", wrap(values[0] - values[1]))
+		if op == "MUL": return ("num", wrap((values[0] * values[1]) >> SHIFT))
+		if op == "DIV" and values[1] != 0:
+			q = abs(values[0] << SHIFT) // abs(values[1])
+			return ("num", wrap(q if (values[0] < 0) == (values[1] < 0) else -q))
+		if op == "NEG": return ("num", wrap(-values[0]))
+		if op == "ABS": return ("num", wrap(abs(values[0])))
+		if op == "MIN": return ("num", min(values))
+		if op == "MAX": return ("num", max(values))
+		if op == "FRAC": return ("num", values[0] & (ONE - 1))
+		if op == "CLAMP": return ("num", max(0, min(ONE, values[0])))
+	# a / k is a * (1/k)
+	if op == "DIV" and args[1][0] == "num" and args[1][1] != 0:
+		return fold(("op", "MUL", args[0], ("num", to_fixed(ONE / args[1][1]))))
+	return ("op", op) + tuple(args)
+
+def varies(node):
+	"""True if the node depends on the LED"""
+	if node[0] == "in":
+		return node[1] == "I"
+	if node[0] == "op":
+		return any(varies(a) for a in node[2:])
+	return False
+
+def count_uses(node, counts):
+	if node[0] != "op":
+		return
+	counts[node] = counts.get(node, 0) + 1
+	if counts[node] == 1:
+		for a in node[2:]:
+			count_uses(a, counts)
+
+# --- code generation
+
+class Emitter:
+	def __init__(self):
+		self.frame = []
+		self.led = []
+		self.registers = {}
+		self.counts = {}
+
+	def register(self, node):
+		if len(self.registers) >= REGS:
+			raise CompileError("too many intermediate values (more than %d registers)" % REGS)
+		self.registers[node] = len(self.registers)
+		return self.registers[node]
+
+	def emit(self, node, code):
+		"""Emits code that pushes the node's value"""
+		if node in self.registers:
+			code.append(("LOAD", self.registers[node]))
+			return
+		if node[0] == "num":
+			code.append(("CONST", node[1]))
+			return
+		if node[0] == "in":
+			code.append((node[1],))
+			return
+
+		# loop invariant: compute in the frame section, load from a register
+		if code is self.led and not varies(node):
+			self.emit(node, self.frame)
+			self.frame.append(("STORE", self.register(node)))
+			code.append(("LOAD", self.registers[node]))
+			return
+
+		op, args = node[1], node[2:]
+		if op in ("ADD", "SUB", "MUL") and args[1][0] == "num":
+			self.emit(args[0], code)
+			k = args[1][1]
+			code.append(("MULK", k) if op == "MUL" else ("ADDK", k if op == "ADD" else wrap(-k)))
+		elif op == "ADD" and args[0][0] == "num":
+			self.emit(args[1], code)
+			code.append(("ADDK", args[0][1]))
+		elif op == "MUL" and args[0][0] == "num":
+			self.emit(args[1], code)
+			code.append(("MULK", args[0][1]))
+		elif op == "PALETTE":
+			self.emit(args[1], code)
+			code.append(("PALETTE", args[0][1]))
+		else:
+			for a in args:
+				self.emit(a, code)
+			code.append((op,))
+
+		# computed once, used again later
+		if self.counts.get(node, 0) > 1:
+			code.append(("STORE", self.register(node)))
+			code.append(("LOAD", self.registers[node]))
+
+def assemble(code):
+	out = bytearray()
+	for instruction in code:
+		out.append(OP[instruction[0]])
+		size = OPERAND.get(instruction[0], 0)
+		if size:
+			out += (instruction[1] & (2**(8*size) - 1)).to_bytes(size, "little")
+	return out
+
+def max_depth(code):
+	depth = peak = 0
+	for instruction in code:
+		depth += STACK_EFFECT.get(instruction[0], 0)
+		peak = max(peak, depth)
+	return peak
+
+def compile_program(text):
+	tree = fold(parse(text))
+	emitter = Emitter()
+	count_uses(tree, emitter.counts)
+	emitter.emit(tree, emitter.led)
+
+	if max(max_depth(emitter.frame), max_depth(emitter.led)) > STACK:
+		raise CompileError("expression too deep (more than %d stack entries)" % STACK)
+	frame, led = assemble(emitter.frame), assemble(emitter.led)
+	program = bytes([ord("V"), VERSION]) + len(frame).to_bytes(2, "little") + len(led).to_bytes(2, "little") + frame + led
+	if len(program) > MAX_PROGRAM:
+		raise CompileError("program too long (%d of %d bytes)" % (len(program), MAX_PROGRAM))
+	return program, emitter
+
+def listing(emitter):
+	lines = []
+	for name, code in (("frame", emitter.frame), ("led", emitter.led)):
+		lines.append("%s:" % name)
+		for instruction in code:
+			operand = ""
+			if len(instruction) > 1:
+				value = instruction[1]
+				operand = " %d" % value if instruction[0] in ("LOAD", "STORE", "PALETTE") else " %g" % (value / ONE)
+			lines.append("\t%s%s" % (instruction[0], operand))
+	return "\n".join(lines)
+
+def main():
+	parser = argparse.ArgumentParser()
+	parser.add_argument("source")
+	parser.add_argument("--slot", type=int, default=0)
+	parser.add_argument("--c", metavar="NAME", help="print a C array instead of the upload command")
+	parser.add_argument("--list", action="store_true", help="print the bytecode to stderr")
+	parser.add_argument("--port", help="upload to the firmware at this serial port")
+	args = parser.parse_args()
+
+	try:
+		program, emitter = compile_program(open(args.source).read())
+	except CompileError as e:
+		sys.exit("%s: %s" % (args.source, e))
+
+	if args.list:
+		print(listing(emitter), file=sys.stderr)
+	print("// %d bytes, %d per frame, %d per LED" % (len(program), len(emitter.frame), len(emitter.led)), file=sys.stderr)
+
+	if args.c:
+		print("const uint8_t %s[%d] = {" % (args.c, len(program)))
+		for start in range(0, len(program), 12):
+			print("\t" + " ".join("0x%02x," % b for b in program[start:start+12]))
+		print("};")
+		return
+
+	command = "vm %d %s" % (args.slot, program.hex())
+	if not args.port:
+		print(command)
+		return
+
+	import serial
+	with serial.Serial(args.port, 115200, timeout=2) as port:
+		port.write((command + "\n").encode())
+		for line in port.readlines():
+			line = line.decode(errors="replace").strip()
+			print(line)
+			if line.startswith("vm "):
+				break
+
+if __name__ == "__main__":
+	main()
@@ -31,6 +31,7 @@
 #include <libopencm3/stm32/gpio.h>
 
 #include "adc.h"
+#include "sensors.h"
 
 #define ADC_CHANNEL 0
 
@@ -64,8 +65,6 @@ void adc_init(void)
 	adc_calibrate(ADC1);
 }
 
-int adc_value = -1;
-
 static void start_conversion(void)
 {
 	uint8_t channel_array[16];
@@ -95,7 +94,7 @@ void adc_poll(void)
 
 			if (count >= N_SAMPLES)
 			{
-				adc_value = sum / count;
+				sensors_publish_adc(sum / count);
 				count = 0;
 				sum = 0;
 			}
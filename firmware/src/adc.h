@@ -7,11 +7,9 @@
  *   - PA0
  */
 
-/** The filtered ADC reading. This is the average over 100 samples, because
-  * otherwise, the signal would by noise as hell */
-extern int adc_value;
-
-/** Must be called periodically. Polls the ADC and updates adc_value */
+/** Must be called periodically. Polls the ADC and publishes the filtered reading
+  * as sensor_state.adc_value (see sensors.h). This is the average over 100 samples,
+  * because otherwise, the signal would by noise as hell */
 void adc_poll(void);
 
 /** Initializes the ADC. Must be called before using this module */
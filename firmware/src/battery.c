@@ -41,7 +41,7 @@ static int batt_estimate_cells(int millivolts)
 }
 
 // remaining:               100    95   90    85    80    75    70    65    60    55    50    45    40    35     30    25    20    15     10   5    0
-static int voltages[21] = {4200, 4000, 3950, 3890, 3840, 3800, 3760, 3730, 3700, 3675, 3650,  3630, 3610, 3600, 3585, 3550, 3510, 3450, 3380, 3300, 3000};
+static const int voltages[21] = {4200, 4000, 3950, 3890, 3840, 3800, 3760, 3730, 3700, 3675, 3650,  3630, 3610, 3600, 3585, 3550, 3510, 3450, 3380, 3300, 3000};
 #define N_VOLTAGES 21
 #define N_INTERVALS (N_VOLTAGES-1)
 
@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdint.h>
+#include "bench.h"
+#include "ledpattern.h"
+#include "ws2812.h"
+#include "noise.h"
+#include "output.h"
+#include "particles.h"
+
+void bench_trace(int frame, struct bench_input *in)
+{
+	static fixed_t pos0 = 0;
+	static int last_frame = -1;
+
+	frame %= BENCH_FRAMES;
+	if (frame <= last_frame)
+		pos0 = 0;
+	last_frame = frame;
+
+	/* 0..3 sec: accelerate to 200 ledunits/sec, 3..7 sec: cruise, 7..10 sec: brake */
+	fixed_t velocity;
+	if (frame < 3*FPS)
+		velocity = ((fixed_t)200 << SHIFT) * frame / (3*FPS);
+	else if (frame < 7*FPS)
+		velocity = 200 << SHIFT;
+	else
+		velocity = ((fixed_t)200 << SHIFT) * (BENCH_FRAMES - frame) / (3*FPS);
+
+	pos0 += velocity / FPS;
+
+	in->t = 1000 + frame;
+	in->pos0 = pos0;
+	in->velocity = velocity;
+	in->brightness = 1000 - 750 * (frame % (2*FPS)) / (2*FPS); // the button's brightness ramp
+	in->batt_cells = 3;
+	in->batt_percent = 100 - 100 * frame / BENCH_FRAMES;
+	in->slow_warning = 0;
+}
+
+/* Renders one frame of pattern p */
+typedef void (*bench_frame_t)(int p, const struct bench_input *in);
+
+/* Measures one pattern over the trace. The mean is taken from one counter reading
+ * around the whole trace minus the cost of an empty run, so that the counter's own
+ * overhead does not dominate cheap patterns. The maximum is measured per frame.
+ * The trace is repeated `runs` times and the best run is reported, which filters
+ * out disturbances by the host's scheduler. */
+static uint32_t measure(bench_counter_t counter, bench_frame_t frame_fn, int p, int runs,
+	const char *group, const char *name, const char *unit)
+{
+	struct bench_input in;
+	uint32_t best_sum = UINT32_MAX, best_max = UINT32_MAX;
+
+	for (int run=0; run<runs; run++)
+	{
+		uint32_t start = counter();
+		for (int frame=0; frame<BENCH_FRAMES; frame++)
+			bench_trace(frame, &in);
+		uint32_t overhead = counter() - start;
+
+		start = counter();
+		for (int frame=0; frame<BENCH_FRAMES; frame++)
+		{
+			bench_trace(frame, &in);
+			frame_fn(p, &in);
+		}
+		uint32_t sum = counter() - start;
+		sum = sum > overhead ? sum - overhead : 0;
+
+		uint32_t max = 0;
+		for (int frame=0; frame<BENCH_FRAMES; frame++)
+		{
+			bench_trace(frame, &in);
+			start = counter();
+			frame_fn(p, &in);
+			uint32_t cost = counter() - start;
+			if (cost > max) max = cost;
+		}
+
+		if (sum < best_sum) best_sum = sum;
+		if (max < best_max) best_max = max;
+	}
+
+	printf("%s\t%s\t%d\t%lu\t%lu\t%s\n", group, name, BENCH_FRAMES,
+		(unsigned long)(best_sum / BENCH_FRAMES), (unsigned long)best_max, unit);
+	return best_sum / BENCH_FRAMES;
+}
+
+static void frame_bottom(int p, const struct bench_input *in)
+{
+	ledpattern_brightness = in->brightness;
+	ledpatterns_bottom[p].render(led_data, in->t, in->pos0, in->velocity);
+}
+
+static void frame_front(int p, const struct bench_input *in)
+{
+	ledpatterns_front[p].render(led_data, in->t, in->batt_cells, in->batt_percent, in->slow_warning);
+}
+
+static void frame_bat_empty(int p, const struct bench_input *in)
+{
+	(void) p;
+	ledpattern_bat_empty(led_data, in->t, in->batt_cells);
+}
+
+/* noise kernels, each evaluating the same three octaves for a row of N_BOTTOM LEDs, three times
+ * (like the lava pattern does for hue, value and saturation) */
+static volatile int32_t noise_sink;
+
+static void frame_noise(int p, const struct bench_input *in)
+{
+	(void) p;
+	int32_t sum = 0;
+	for (int n=0; n<3; n++)
+		for (int i=0; i<N_BOTTOM; i++)
+			sum += fractal_noise((((fixed_t)i)<<SHIFT) / 7, (((fixed_t)in->t)<<SHIFT) / 60, ONE/2, ONE/4, ONE/8);
+	noise_sink = sum;
+}
+
+static void frame_gnoise(int p, const struct bench_input *in)
+{
+	(void) p;
+	int32_t sum = 0;
+	for (int n=0; n<3; n++)
+		for (int i=0; i<N_BOTTOM; i++)
+			sum += gnoise_fractal(i * (ONE / 7), (((fixed_t)in->t)<<SHIFT) / 60, 3);
+	noise_sink = sum;
+}
+
+static void frame_gnoise_row(int p, const struct bench_input *in)
+{
+	(void) p;
+	int32_t row[N_BOTTOM];
+	int32_t sum = 0;
+	for (int n=0; n<3; n++)
+	{
+		gnoise_row(row, N_BOTTOM, 0, ONE / 7, (((fixed_t)in->t)<<SHIFT) / 60, 3);
+		sum += row[n];
+	}
+	noise_sink = sum;
+}
+
+/* the output stage for one frame, including a table rebuild, as the trace ramps the brightness */
+static void frame_output(int p, const struct bench_input *in)
+{
+	(void) p;
+	uint32_t sum = 0;
+	output_set_bottom(in->brightness, 1000);
+	for (int i=0; i<LED_COUNT; i++)
+		sum += output_map_led(i, led_data[i]);
+	noise_sink = sum;
+}
+
+/* what the ws2812 encoder adds per frame: the chain is refreshed about four
+ * times per frame, each time mapping and dithering every LED */
+static void frame_dither(int p, const struct bench_input *in)
+{
+	(void) p;
+	(void) in;
+	static uint8_t remainder[LED_COUNT][3];
+	uint32_t sum = 0;
+	for (int refresh=0; refresh<4; refresh++)
+		for (int i=0; i<LED_COUNT; i++)
+			sum += output_dither(output_lut_led(i), led_data[i], remainder[i]);
+	noise_sink = sum;
+}
+
+/* a full particle pool: emit what has died, move and render everything */
+static void frame_particles(int p, const struct bench_input *in)
+{
+	(void) p;
+	(void) in;
+	static struct particles ps;
+	static bool initialized = false;
+	if (!initialized)
+	{
+		particles_init(&ps, 1);
+		initialized = true;
+	}
+
+	while (ps.count < PARTICLES_MAX)
+	{
+		uint32_t r = particles_random(&ps);
+		particles_emit(&ps, (r % N_BOTTOM) << SHIFT, (int32_t)(r >> 16) - 32768, r & 0xFFFFFF, 1 + (r >> 24) % 60);
+	}
+	particles_update(&ps);
+	particles_render(&ps, led_data);
+}
+
+void bench_run(bench_counter_t counter, const char *unit, int runs)
+{
+	for (int p=0; p<N_BOTTOM_PATTERNS; p++)
+	{
+		ledpattern_bottom_activate(p);
+		measure(counter, frame_bottom, p, runs, "bottom", ledpatterns_bottom[p].name, unit);
+	}
+
+	for (int p=0; p<N_FRONT_PATTERNS; p++)
+	{
+		ledpattern_front_activate(p);
+		measure(counter, frame_front, p, runs, "front", ledpatterns_front[p].name, unit);
+	}
+
+	measure(counter, frame_bat_empty, 0, runs, "bat_empty", "bat_empty", unit);
+
+	measure(counter, frame_noise, 0, runs, "kernel", "fractal_noise", unit);
+	measure(counter, frame_gnoise, 0, runs, "kernel", "gnoise_fractal", unit);
+	measure(counter, frame_gnoise_row, 0, runs, "kernel", "gnoise_row", unit);
+	measure(counter, frame_output, 0, runs, "kernel", "output_stage", unit);
+	measure(counter, frame_dither, 0, runs, "kernel", "output_dither", unit);
+
+	// compare this against PARTICLES_CYCLES
+	uint32_t particles = measure(counter, frame_particles, 0, runs, "kernel", "particles", unit);
+	printf("# particles: %lu %s per particle\n", (unsigned long)(particles / PARTICLES_MAX), unit);
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <stdint.h>
+#include "common.h"
+
+/* Pattern benchmark module
+ *
+ * Besides the patterns, the noise kernels are measured in the group "kernel".
+ *
+ * Resources: none. The caller supplies the counter, e.g. the DWT cycle counter
+ * on the target or a clock on the host (see ../host/bench_host.c).
+ *
+ * Usage:
+ *   - call bench_run(counter, unit, runs);
+ *   - one line per pattern is printed, tab-separated:
+ *     group, name, frames, mean, max, unit
+ *     (see ../host/bench_check.py for the comparison against the baseline)
+ */
+
+/** Number of frames in the input trace (10 sec at 60 fps) */
+#define BENCH_FRAMES 600
+
+/** One frame of the input trace */
+struct bench_input
+{
+	int t;
+	fixed_t pos0;
+	fixed_t velocity;
+	int brightness;
+	int batt_cells;
+	int batt_percent;
+	int slow_warning;
+};
+
+/** Fills in the input for a frame of the fixed trace: accelerate from standstill,
+  * cruise, brake to a halt. Frames >= BENCH_FRAMES wrap around. */
+void bench_trace(int frame, struct bench_input *in);
+
+typedef uint32_t (*bench_counter_t)(void);
+
+/** Runs every pattern over the trace and prints the cost per frame, as
+  * measured by counter(), in the given unit. The best of `runs` repetitions
+  * is reported. */
+void bench_run(bench_counter_t counter, const char *unit, int runs);
@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+
+# Prints the flash and RAM usage of every module, taken from the linker map file,
+# and fails if one of the limits in budget.cfg is exceeded.
+#
+# Usage: budget.py tretroller.map budget.cfg
+
+import sys
+import re
+from collections import defaultdict
+
+try:
+	mapfile = sys.argv[1]
+	cfgfile = sys.argv[2]
+except IndexError:
+	print("Usage: %s file.map budget.cfg" % sys.argv[0])
+	exit(1)
+
+# flash: code and constants. .data is both in flash (initial values) and in RAM.
+FLASH_SECTIONS = (".text", ".rodata", ".data", ".ARM.exidx", ".ARM.extab", ".init_array", ".fini_array", ".preinit_array")
+RAM_SECTIONS = (".data", ".bss", "COMMON")
+
+def category(section):
+	result = set()
+	for prefix in FLASH_SECTIONS:
+		if section == prefix or section.startswith(prefix + "."):
+			result.add("flash")
+	for prefix in RAM_SECTIONS:
+		if section == prefix or section.startswith(prefix + "."):
+			result.add("ram")
+	return result
+
+def module_name(path):
+	name = path.split("/")[-1]
+	# libraries: "/path/libc_nano.a(lib_a-memset.o)"
+	match = re.match(r"(lib[^(]*)\.a\(", name)
+	if match:
+		return match.group(1)
+	return re.sub(r"\.o$", "", name)
+
+usage = defaultdict(lambda: {"flash": 0, "ram": 0})
+
+in_memory_map = False
+discarded = False
+pending_section = None
+for line in open(mapfile).readlines():
+	if line.startswith("Discarded input sections"):
+		discarded = True
+		continue
+	if line.startswith("Linker script and memory map"):
+		discarded = False
+		in_memory_map = True
+		continue
+	if discarded or not in_memory_map:
+		continue
+
+	fields = line.split()
+	if not line.startswith(" ") or not fields:
+		pending_section = None
+		continue
+
+	# input section lines look like " .text.foo  0x08000150  0x2c bin/main.o";
+	# long section names are wrapped, the rest follows on the next line.
+	if len(fields) == 1 and fields[0].startswith("."):
+		pending_section = fields[0]
+		continue
+	if pending_section and len(fields) >= 3 and fields[0].startswith("0x"):
+		fields = [pending_section] + fields
+	pending_section = None
+
+	if len(fields) < 4 or not fields[1].startswith("0x") or not fields[2].startswith("0x"):
+		continue
+	section, size, path = fields[0], int(fields[2], 16), " ".join(fields[3:])
+	if section == "*fill*":
+		continue
+	for cat in category(section):
+		usage[module_name(path)][cat] += size
+
+limits = {}
+for line in open(cfgfile).readlines():
+	line = line.split("#")[0].strip()
+	if not line:
+		continue
+	name, flash_limit, ram_limit = line.split()
+	limits[name] = (int(flash_limit), int(ram_limit))
+
+total = {"flash": sum(u["flash"] for u in usage.values()), "ram": sum(u["ram"] for u in usage.values())}
+
+failed = False
+print("%-20s %8s %8s" % ("module", "flash", "ram"))
+for name in sorted(usage, key=lambda n: -usage[n]["ram"]*1000 - usage[n]["flash"]) + ["total"]:
+	u = total if name == "total" else usage[name]
+	if name == "total":
+		print("-" * 38)
+	status = ""
+	if name in limits:
+		flash_limit, ram_limit = limits[name]
+		if u["flash"] > flash_limit:
+			status += " FAIL: flash limit is %d" % flash_limit
+		if u["ram"] > ram_limit:
+			status += " FAIL: ram limit is %d" % ram_limit
+		failed |= bool(status)
+	print("%-20s %8d %8d%s" % (name, u["flash"], u["ram"], status))
+
+exit(1 if failed else 0)
@@ -0,0 +1,84 @@
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/flash.h>
+#include <libopencm3/stm32/timer.h>
+
+#include "clock.h"
+#include "tacho.h"
+
+struct clock_config
+{
+	uint32_t pllmul;
+	uint32_t pllxtpre;
+	uint32_t ppre1;    // APB1 must not exceed 36 MHz
+	uint32_t adcpre;   // the ADC clock must not exceed 14 MHz
+	uint32_t latency;
+};
+
+const uint32_t clock_mode_mhz[CLOCK_N_MODES] = { 24, 36, 48, 72 };
+
+static const struct clock_config configs[CLOCK_N_MODES] = {
+	{ RCC_CFGR_PLLMUL_PLL_CLK_MUL3, RCC_CFGR_PLLXTPRE_HSE_CLK, RCC_CFGR_PPRE1_HCLK_NODIV, RCC_CFGR_ADCPRE_PCLK2_DIV2, FLASH_ACR_LATENCY_0WS },
+	{ RCC_CFGR_PLLMUL_PLL_CLK_MUL9, RCC_CFGR_PLLXTPRE_HSE_CLK_DIV2, RCC_CFGR_PPRE1_HCLK_NODIV, RCC_CFGR_ADCPRE_PCLK2_DIV4, FLASH_ACR_LATENCY_1WS },
+	{ RCC_CFGR_PLLMUL_PLL_CLK_MUL6, RCC_CFGR_PLLXTPRE_HSE_CLK, RCC_CFGR_PPRE1_HCLK_DIV2, RCC_CFGR_ADCPRE_PCLK2_DIV4, FLASH_ACR_LATENCY_1WS },
+	{ RCC_CFGR_PLLMUL_PLL_CLK_MUL9, RCC_CFGR_PLLXTPRE_HSE_CLK, RCC_CFGR_PPRE1_HCLK_DIV2, RCC_CFGR_ADCPRE_PCLK2_DIV6, FLASH_ACR_LATENCY_2WS },
+};
+
+uint32_t clock_mhz = 0;
+enum clock_mode clock_mode = CLOCK_72MHZ;
+
+static void set_frequencies(uint32_t mhz, uint32_t ppre1)
+{
+	clock_mhz = mhz;
+	rcc_ahb_frequency = mhz * 1000000;
+	rcc_apb1_frequency = (ppre1 == RCC_CFGR_PPRE1_HCLK_DIV2) ? mhz * 500000 : mhz * 1000000;
+	rcc_apb2_frequency = mhz * 1000000;
+}
+
+void clock_set_prescaler(uint32_t timer, uint16_t prescaler)
+{
+	// the update event loads the prescaler but also clears the counter.
+	// URS keeps it from raising an update interrupt.
+	uint32_t count = timer_get_counter(timer);
+	timer_set_prescaler(timer, prescaler);
+	timer_update_on_overflow(timer);
+	timer_generate_event(timer, TIM_EGR_UG);
+	timer_set_counter(timer, count);
+	timer_update_on_any(timer);
+}
+
+void clock_init(void)
+{
+	clock_set(CLOCK_72MHZ);
+}
+
+void clock_set(enum clock_mode mode)
+{
+	const struct clock_config *config = &configs[mode];
+
+	// run from the HSE while the PLL is reconfigured
+	rcc_osc_on(RCC_HSE);
+	rcc_wait_for_osc_ready(RCC_HSE);
+	flash_set_ws(FLASH_ACR_LATENCY_2WS);
+	rcc_set_sysclk_source(RCC_CFGR_SW_SYSCLKSEL_HSECLK);
+	rcc_set_ppre1(RCC_CFGR_PPRE1_HCLK_NODIV);
+	set_frequencies(8, RCC_CFGR_PPRE1_HCLK_NODIV);
+	tacho_retime();
+
+	rcc_osc_off(RCC_PLL);
+	rcc_set_hpre(RCC_CFGR_HPRE_SYSCLK_NODIV);
+	rcc_set_ppre2(RCC_CFGR_PPRE2_HCLK_NODIV);
+	rcc_set_adcpre(config->adcpre);
+	rcc_set_pll_multiplication_factor(config->pllmul);
+	rcc_set_pll_source(RCC_CFGR_PLLSRC_HSE_CLK);
+	rcc_set_pllxtpre(config->pllxtpre);
+	rcc_osc_on(RCC_PLL);
+	rcc_wait_for_osc_ready(RCC_PLL);
+
+	rcc_set_ppre1(config->ppre1);
+	rcc_set_sysclk_source(RCC_CFGR_SW_SYSCLKSEL_PLLCLK);
+	flash_set_ws(config->latency);
+
+	clock_mode = mode;
+	set_frequencies(clock_mode_mhz[mode], config->ppre1);
+	tacho_retime();
+}
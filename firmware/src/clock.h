@@ -0,0 +1,37 @@
+#pragma once
+#include <stdint.h>
+
+/* Clock module: switches the core clock between 24, 36, 48 and 72 MHz.
+ *
+ * Resources: RCC, flash wait states
+ *
+ * All modes run the PLL from the 8 MHz HSE. The APB1 prescaler is chosen so
+ * that every timer is clocked with the core clock, so timer periods in
+ * core cycles are clock_mhz per microsecond in every mode.
+ *
+ * A switch passes through the HSE for the PLL to lock again. Timers that must
+ * keep their time base (the tacho's TIM1) are retimed with
+ * clock_set_prescaler() at both steps, which keeps their counter running.
+ *
+ * Usage:
+ *   - call clock_init() first; it sets up 72 MHz
+ *   - call clock_set() from thread mode, with everything that depends on
+ *     the clock stopped; it retimes TIM1 via tacho_retime() by itself
+ *   - then update the prescalers of other timers and the USART baud rate
+ */
+
+enum clock_mode { CLOCK_24MHZ, CLOCK_36MHZ, CLOCK_48MHZ, CLOCK_72MHZ, CLOCK_N_MODES };
+
+extern const uint32_t clock_mode_mhz[CLOCK_N_MODES];
+
+/** The current core and timer clock */
+extern uint32_t clock_mhz;
+extern enum clock_mode clock_mode;
+
+void clock_init(void);
+
+/** Switches to the given mode. Also used after STOP mode, where the MCU runs on the HSI. */
+void clock_set(enum clock_mode mode);
+
+/** Sets a timer's prescaler immediately instead of at its next update, keeping its counter */
+void clock_set_prescaler(uint32_t timer, uint16_t prescaler);
@@ -34,7 +34,7 @@
  * Resources: none
  */
 
-/** Converts hexagonal HSV to gamma-corrected 32-bit-words suitable for the ws2812 leds.
+/** Converts hexagonal HSV to 32-bit-words for led_data. Gamma correction happens in the output stage.
   * 
   * hue: 0..3599; saturation: 0..999; value: 0..999
   * Output format: 0x00GGRRBB
@@ -43,7 +43,7 @@
   */
 uint32_t hsv(uint32_t hue, uint32_t saturation, uint32_t value);
 
-/** Converts circular HSV to gamma-corrected 32-bit-words suitable for the ws2812 leds.
+/** Converts circular HSV to 32-bit-words for led_data. Gamma correction happens in the output stage.
   * 
   * hue: 0..3599; saturation: 0..999; value: 0..999
   * Output format: 0x00GGRRBB
@@ -53,8 +53,13 @@ uint32_t hsv(uint32_t hue, uint32_t saturation, uint32_t value);
 uint32_t hsv2(uint32_t hue, uint32_t saturation, uint32_t value);
 
 
-/** Clamps val into 0..255 and applies a gamma correction for correct led brightness */
-int clamp_and_gamma(int val);
-
 #define RGB(r,g,b) (((r) << 8) | (b) | ((g) << 16))
-#define RGBg(r,g,b) RGB(clamp_and_gamma(r), clamp_and_gamma(g), clamp_and_gamma(b))
+
+/** Interpolates between two 0x00GGRRBB colours, frac in 0..256. Green and blue
+  * share one multiplication; the products cannot overflow into each other. */
+static inline uint32_t lerp_grb(uint32_t a, uint32_t b, int frac)
+{
+	uint32_t gb = ((a & 0xFF00FF) * (256 - frac) + (b & 0xFF00FF) * frac) >> 8;
+	uint32_t r = ((a & 0x00FF00) * (256 - frac) + (b & 0x00FF00) * frac) >> 8;
+	return (gb & 0xFF00FF) | (r & 0x00FF00);
+}
@@ -11,6 +11,8 @@ typedef int64_t fixed_t;
 #define N_FRONT 5
 #define N_BOTTOM 26
 
+#define BRAKE_COLOR 0x00ff00 // bottom strips while braking, see ledpattern_bottom_brake()
+
 #define FPS 60
 #define FREQUENCY_FACTOR 1000 // frequency_millihertz / FREQUENCY_FACTOR = wheel frequency in hertz
 
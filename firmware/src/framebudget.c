@@ -0,0 +1,50 @@
+#include "framebudget.h"
+
+void framebudget_init(struct framebudget *fb, int max_level)
+{
+	fb->max_level = max_level;
+	fb->level = 0;
+	fb->good_frames = 0;
+	fb->hold_frames = FRAMEBUDGET_HOLD_FRAMES;
+	fb->raised_frames = -1;
+	fb->frames = 0;
+	fb->dropped = 0;
+}
+
+int framebudget_update(struct framebudget *fb, uint32_t cycles, uint32_t period)
+{
+	uint64_t load = (uint64_t)cycles * 1000;
+
+	fb->frames++;
+	if (cycles > period)
+		fb->dropped++;
+
+	if (fb->raised_frames >= 0 && ++fb->raised_frames > fb->hold_frames)
+	{
+		// the last raise held; start over with the short hold time
+		fb->raised_frames = -1;
+		fb->hold_frames = FRAMEBUDGET_HOLD_FRAMES;
+	}
+
+	if (load > (uint64_t)period * FRAMEBUDGET_HIGH_PERMILLE)
+	{
+		if (fb->level < fb->max_level)
+			fb->level++;
+		if (fb->raised_frames >= 0 && fb->hold_frames < FRAMEBUDGET_MAX_HOLD_FRAMES)
+			fb->hold_frames *= 2;
+		fb->raised_frames = -1;
+		fb->good_frames = 0;
+	}
+	else if (load > (uint64_t)period * FRAMEBUDGET_LOW_PERMILLE)
+	{
+		fb->good_frames = 0;
+	}
+	else if (fb->level > 0 && ++fb->good_frames >= fb->hold_frames)
+	{
+		fb->level--;
+		fb->good_frames = 0;
+		fb->raised_frames = 0;
+	}
+
+	return fb->level;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <stdint.h>
+#include "common.h"
+
+/* Frame budget module: lowers the pattern quality when frames overrun.
+ *
+ * Resources: none
+ *
+ * The renderer measures every frame in core cycles. A frame that takes more
+ * than FRAMEBUDGET_HIGH_PERMILLE of the frame period lowers the quality by one
+ * level at once (see ledpattern_quality). After a hold time in which no frame
+ * took more than FRAMEBUDGET_LOW_PERMILLE, the quality is raised again. If that
+ * leads to an overrun within the hold time, the hold time doubles, so the
+ * quality does not oscillate between two levels. A frame that takes longer
+ * than the frame period is counted as dropped: the next timer update has
+ * already passed.
+ *
+ * Usage:
+ *   - call framebudget_init(&fb, max_level) once
+ *   - call framebudget_update(&fb, cycles, period) after every frame; it returns
+ *     the quality level for the next frame
+ */
+
+#define FRAMEBUDGET_HIGH_PERMILLE 900
+#define FRAMEBUDGET_LOW_PERMILLE 500
+#define FRAMEBUDGET_HOLD_FRAMES (2 * FPS)
+#define FRAMEBUDGET_MAX_HOLD_FRAMES (64 * FPS)
+
+struct framebudget
+{
+	int max_level;
+	int level;
+	int good_frames;   // frames since the last one above FRAMEBUDGET_LOW_PERMILLE
+	int hold_frames;
+	int raised_frames; // frames since the last raise, -1 if settled
+	uint32_t frames;
+	uint32_t dropped;
+};
+
+void framebudget_init(struct framebudget *fb, int max_level);
+
+/** cycles: the last frame's duration, period: the frame period, both in core cycles */
+int framebudget_update(struct framebudget *fb, uint32_t cycles, uint32_t period);
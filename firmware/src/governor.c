@@ -0,0 +1,43 @@
+#include "governor.h"
+#include "common.h"
+
+static uint32_t frame_cycles(const struct governor *gov, int mode)
+{
+	return gov->mode_mhz[mode] * 1000000 / FPS;
+}
+
+void governor_init(struct governor *gov, int n_modes, const uint32_t *mode_mhz, int mode)
+{
+	gov->n_modes = n_modes;
+	gov->mode_mhz = mode_mhz;
+	gov->mode = mode;
+	gov->peak_cycles = 0;
+	gov->frames = 0;
+}
+
+int governor_update(struct governor *gov, uint32_t cycles)
+{
+	if ((uint64_t)cycles * 1000 > (uint64_t)frame_cycles(gov, gov->mode) * GOVERNOR_HIGH_PERMILLE)
+	{
+		gov->mode = gov->n_modes - 1;
+		gov->peak_cycles = 0;
+		gov->frames = 0;
+		return gov->mode;
+	}
+
+	if (cycles > gov->peak_cycles)
+		gov->peak_cycles = cycles;
+
+	if (++gov->frames == FPS)
+	{
+		// a frame needs about the same number of cycles at every clock
+		int mode = 0;
+		while (mode < gov->mode && (uint64_t)gov->peak_cycles * 1000 > (uint64_t)frame_cycles(gov, mode) * GOVERNOR_LOW_PERMILLE)
+			mode++;
+		gov->mode = mode;
+		gov->peak_cycles = 0;
+		gov->frames = 0;
+	}
+
+	return gov->mode;
+}
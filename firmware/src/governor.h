@@ -0,0 +1,35 @@
+#pragma once
+#include <stdint.h>
+
+/* Clock governor module: picks the slowest clock mode that renders in time.
+ *
+ * Resources: none
+ *
+ * The renderer measures each frame in core cycles, including the WS2812
+ * interrupts that preempt it. The governor switches to the fastest mode at
+ * once when a frame uses more than GOVERNOR_HIGH_PERMILLE of its time. Once
+ * per second, it steps down to the slowest mode in which the longest frame
+ * of that second would have used at most GOVERNOR_LOW_PERMILLE.
+ *
+ * Usage:
+ *   - call governor_init(&gov, n_modes, mode_mhz, start_mode) once
+ *   - call governor_update(&gov, cycles) after every frame; it returns the
+ *     mode to switch to
+ */
+
+#define GOVERNOR_HIGH_PERMILLE 750
+#define GOVERNOR_LOW_PERMILLE 450
+
+struct governor
+{
+	int n_modes;
+	const uint32_t *mode_mhz; // ascending
+	int mode;
+	uint32_t peak_cycles;
+	int frames;
+};
+
+void governor_init(struct governor *gov, int n_modes, const uint32_t *mode_mhz, int mode);
+
+/** cycles: the last frame's duration in core cycles, at the current mode */
+int governor_update(struct governor *gov, uint32_t cycles);
@@ -8,7 +8,7 @@ try:
 	filename = sys.argv[1]
 	n = int(sys.argv[2])
 except:
-	print("Usage: %s filename.log n_magnets [strip_amount]")
+	print("Usage: %s filename.log n_magnets [strip_amount [channel]]")
 	exit(1)
 
 strip_amount = n+1
@@ -17,11 +17,18 @@ try:
 except:
 	pass
 
+# the TIM1 capture channel of the sensor, see tacho.c
+prefix = "TIM1_CCR1 = "
+try:
+	prefix = "TIM1_CCR%d = " % int(sys.argv[4])
+except:
+	pass
+
 
 t_sum = 0
 for line in open(filename).readlines():
-	if line.startswith("TIM1_CCR1 = "):
-		ccr = int(line[12:])
+	if line.startswith(prefix):
+		ccr = int(line[len(prefix):])
 		timesteps.append((t_sum, ccr))
 		t_sum += ccr
 
@@ -1,8 +1,42 @@
 #include "math.h"
 #include "ledpattern.h"
 #include "color.h"
+#include "palette.h"
 #include "noise.h"
+#include "pov.h"
+#include "particles.h"
+#include "vm.h"
 #include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* the scratch arena, see ledpattern.h. uint64_t aligns it for fixed_t. */
+static uint64_t arena[LEDPATTERN_ARENA_SIZE / sizeof(uint64_t)];
+#define FRONT_STATE ((void *)arena)
+#define BOTTOM_STATE ((void *)((uint8_t *)arena + LEDPATTERN_ARENA_FRONT))
+
+static int bottom_active = -1;
+static int front_active = -1;
+
+void ledpattern_bottom_activate(int p)
+{
+	if (bottom_active >= 0 && ledpatterns_bottom[bottom_active].deinit)
+		ledpatterns_bottom[bottom_active].deinit(BOTTOM_STATE);
+	bottom_active = p;
+	memset(BOTTOM_STATE, 0, ledpatterns_bottom[p].state_size);
+	if (ledpatterns_bottom[p].init)
+		ledpatterns_bottom[p].init(BOTTOM_STATE);
+}
+
+void ledpattern_front_activate(int p)
+{
+	if (front_active >= 0 && ledpatterns_front[front_active].deinit)
+		ledpatterns_front[front_active].deinit(FRONT_STATE);
+	front_active = p;
+	memset(FRONT_STATE, 0, ledpatterns_front[p].state_size);
+	if (ledpatterns_front[p].init)
+		ledpatterns_front[p].init(FRONT_STATE);
+}
 
 static int snake_value(int currpos, int snakehead, int snakelen, int fadeout, int full)
 {
@@ -50,7 +84,7 @@ void ledpattern_bat_empty(volatile uint32_t led_data[], int t, int batt_cells)
 		if (t0 < 1 || t1 < 2)
 			batt_empty_flash = 1;
 	}
-	int batt_empty_color = batt_empty_flash ? 0xff0000 : 0x000100; // bright blue flash / dim red glow
+	int batt_empty_color = batt_empty_flash ? 0xff0000 : 0x001c00; // bright blue flash / dim red glow
 
 	for (int i=0; i<N_SIDE; i++)
 	{
@@ -68,14 +102,20 @@ void ledpattern_bat_empty(volatile uint32_t led_data[], int t, int batt_cells)
 	}
 }
 
+struct bat_and_slow_info_state
+{
+	int batt_percent_buf; // hundreths of a percent.
+};
+
 static void ledpattern_front_bat_and_slow_info_brightness(volatile uint32_t led_data[], int t, int batt_cells, int batt_percent, int slow_warning, int brightness)
 {
 	/* use this many LEDs for battery display on the side strips */
 	#define N_BAT_LEDS N_SIDE
 	
 	/* smooth the battery percentage over time */
-	static int batt_percent_buf = 0; // hundreths of a percent.
-	batt_percent_buf = batt_percent_buf + (batt_percent * 100 - batt_percent_buf) / 20;
+	struct bat_and_slow_info_state *state = FRONT_STATE;
+	state->batt_percent_buf += (batt_percent * 100 - state->batt_percent_buf) / 20;
+	int batt_percent_buf = state->batt_percent_buf;
 
 	/* battery state on the sides */
 	for (int i=0; i<N_SIDE; i++)
@@ -99,15 +139,15 @@ void ledpattern_front_bat_and_slow_info(volatile uint32_t led_data[], int t, int
 {
 	ledpattern_front_bat_and_slow_info_brightness(led_data, t, batt_cells, batt_percent, slow_warning, 1000);
 }
-static void ledpattern_front_bat_and_slow_info2(volatile uint32_t led_data[], int t, int batt_cells, int batt_percent, int slow_warning)
+void ledpattern_front_bat_and_slow_info2(volatile uint32_t led_data[], int t, int batt_cells, int batt_percent, int slow_warning)
 {
 	ledpattern_front_bat_and_slow_info_brightness(led_data, t, batt_cells, batt_percent, slow_warning, 750);
 }
-static void ledpattern_front_bat_and_slow_info3(volatile uint32_t led_data[], int t, int batt_cells, int batt_percent, int slow_warning)
+void ledpattern_front_bat_and_slow_info3(volatile uint32_t led_data[], int t, int batt_cells, int batt_percent, int slow_warning)
 {
 	ledpattern_front_bat_and_slow_info_brightness(led_data, t, batt_cells, batt_percent, slow_warning, 500);
 }
-static void ledpattern_front_bat_and_slow_info4(volatile uint32_t led_data[], int t, int batt_cells, int batt_percent, int slow_warning)
+void ledpattern_front_bat_and_slow_info4(volatile uint32_t led_data[], int t, int batt_cells, int batt_percent, int slow_warning)
 {
 	ledpattern_front_bat_and_slow_info_brightness(led_data, t, batt_cells, batt_percent, slow_warning, 250);
 }
@@ -169,7 +209,12 @@ void ledpattern_front_knightrider4(volatile uint32_t led_data[], int t, int batt
 	ledpattern_front_knightrider_brightness(led_data, t, batt_cells, batt_percent, slow_warning, 250);
 }
 
-void ledpattern_bottom_dots(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity, int brightness)
+struct dots_state
+{
+	fixed_t velo_smooth;
+};
+
+void ledpattern_bottom_dots(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity)
 {
 	(void) velocity;
 
@@ -178,10 +223,11 @@ void ledpattern_bottom_dots(volatile uint32_t led_data[], int t, fixed_t pos0, f
 	const int DOT_FADEOUT = 3;
 	const int FADEOUT_ZONE = 7;
 	
-	static fixed_t velo_smooth = 0;
-	velo_smooth += (velocity - velo_smooth) / 10;
+	struct dots_state *state = BOTTOM_STATE;
+	state->velo_smooth += (velocity - state->velo_smooth) / 10;
 
-	fixed_t wobble_amount = ONE - clamp(velo_smooth, 0, ONE);
+	fixed_t wobble_amount = ONE - clamp(state->velo_smooth, 0, ONE);
+	const uint32_t *lut = palette_use(&palette_rainbow);
 
 	for (int i=0; i<N_BOTTOM; i++)
 	{
@@ -196,7 +242,8 @@ void ledpattern_bottom_dots(volatile uint32_t led_data[], int t, fixed_t pos0, f
 
 		value = value * snake_value(i<<SHIFT, FADEOUT_ZONE, (N_BOTTOM<<SHIFT)-2*FADEOUT_ZONE, FADEOUT_ZONE, 1000) / 1000;
 
-		uint32_t color = hsv2(hue, 700, value*brightness/1000 );
+		// hsv2(hue, 700, value); 0xFF00 / 3600 = 4642 / 256
+		uint32_t color = palette_scale(palette_desaturate(palette_lerp(lut, hue * 4642 >> 8), 179), value * 256 / 1000);
 
 		led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM-1-i] = color;
 		led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM+i] = color;
@@ -204,80 +251,158 @@ void ledpattern_bottom_dots(volatile uint32_t led_data[], int t, fixed_t pos0, f
 	
 }
 
-void ledpattern_bottom_3color(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity, int brightness)
+#define NUM(x) (((fixed_t)x)<<SHIFT)
+
+/* Spatial steps of the smooth patterns. These are evaluated at every step-th
+ * LED only ("samples"), and interpolated in between by put_samples(). */
+#define LAVA_STEP 4
+#define WATER_STEP 2
+
+int ledpattern_max_step = N_BOTTOM;
+int ledpattern_quality = 0;
+
+static int sample_step(int step)
 {
-	(void) t; // unused
-	(void) velocity;
+	if (ledpattern_quality >= 2)
+		step *= 2;
+	return clamp(step, 1, ledpattern_max_step);
+}
+
+/** Number of noise octaves to evaluate at the current quality level */
+static int noise_octaves(int octaves)
+{
+	return ledpattern_quality >= 1 ? octaves - 1 : octaves;
+}
+
+/** Samples k*step for k < n_samples(step) cover the strip, the last one may lie beyond its end */
+static int n_samples(int step)
+{
+	return (N_BOTTOM - 2) / step + 2;
+}
 
+/** Writes the samples to both bottom strips, interpolating between them */
+static void put_samples(volatile uint32_t led_data[], const uint32_t samples[], int step)
+{
 	for (int i=0; i<N_BOTTOM; i++)
 	{
-		fixed_t pos = (i << SHIFT) + pos0;
+		int k = i / step;
+		int frac = (i - k * step) * 256 / step;
+		uint32_t color = frac ? lerp_grb(samples[k], samples[k+1], frac) : samples[k];
+		led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM-1-i] = color;
+		led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM+i] = color;
+	}
+}
+
+/* Position-only patterns bake one period of their colours into a texture on
+ * activation. Each frame copies it to the strip at offset pos0, and
+ * interpolates between the texels for the fractional part of pos0. */
+static void put_texture(volatile uint32_t led_data[], const uint32_t texture[], int period, fixed_t pos0)
+{
+	int index = (pos0 >> SHIFT) % period;
+	int frac = (pos0 & (ONE - 1)) >> (SHIFT - 8);
+
+	for (int i=0; i<N_BOTTOM; i++)
+	{
+		int next = (index + 1 == period) ? 0 : index + 1;
+		uint32_t color = texture[index];
+		if (frac && texture[next] != color)
+			color = lerp_grb(color, texture[next], frac);
+		led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM-1-i] = color;
+		led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM+i] = color;
+		index = next;
+	}
+}
+
+int ledpattern_bottom_saturation = 1000;
+
+/* blue, green and red stripes of 30 LEDs each */
+#define THREECOLOR_PERIOD 90
+
+struct threecolor_state
+{
+	uint32_t texture[THREECOLOR_PERIOD];
+};
+
+static void threecolor_init(void *state)
+{
+	struct threecolor_state *s = state;
+	for (int i=0; i<THREECOLOR_PERIOD; i++)
+	{
 		int r,g,b;
-		switch ((((pos/30)>>SHIFT) % 3) )
+		switch (i / 30)
 		{
-			case 0: r=g=0; b=255*brightness/1000; break;
-			case 1: r=b=0; g=255*brightness/1000; break;
-			case 2: g=b=0; r=255*brightness/1000; break;
-			default:
-				r=g=b=64;
+			case 0: r=g=0; b=255; break;
+			case 1: r=b=0; g=255; break;
+			default: g=b=0; r=255; break;
 		}
-
-		led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM-1-i] = RGBg(r,g,b);
-		led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM+i] = RGBg(r,g,b);
+		s->texture[i] = RGB(r,g,b);
 	}
 }
 
-#define NUM(x) (((fixed_t)x)<<SHIFT)
+void ledpattern_bottom_3color(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity)
+{
+	(void) t; // unused
+	(void) velocity;
+
+	struct threecolor_state *state = BOTTOM_STATE;
+	put_texture(led_data, state->texture, THREECOLOR_PERIOD, pos0);
+}
 
-void ledpattern_bottom_lava(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity, int brightness)
+void ledpattern_bottom_lava(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity)
 {
 	(void) pos0;
 	(void) velocity;
 
-	for (int i=0; i<N_BOTTOM; i++)
+	const uint32_t *lut = palette_use(&palette_lava);
+	int step = sample_step(LAVA_STEP);
+	int n = n_samples(step);
+	int octaves = noise_octaves(3);
+	int32_t hue_noise[N_BOTTOM], value_noise[N_BOTTOM], saturation_noise[N_BOTTOM];
+	gnoise_row(hue_noise, n, 0, step * (ONE / 7), NUM(t)/60, octaves);
+	gnoise_row(value_noise, n, NUM(41) / 20, step * (ONE / 20), NUM(t)/300, octaves);
+	gnoise_row(saturation_noise, n, NUM(129) / 9, step * (ONE / 9), NUM(t)/150, octaves);
+
+	uint32_t samples[N_BOTTOM];
+	for (int k=0; k<n; k++)
 	{
-		// lava
-		int hue = 400 + ((200 * fractal_noise( NUM(i) / 7, NUM(t)/60, ONE/2, ONE/4, ONE/8 )) >> SHIFT);
-		int value = 600 + ((400*fractal_noise( ((i+41)<<SHIFT) / 20, (t<<SHIFT)/300, (1<<SHIFT)/2, (1<<SHIFT)/4, (1<<SHIFT)/8 )) >> SHIFT);
-		int saturation = 900 + ((100*fractal_noise( ((i+129)<<SHIFT) / 9, (t<<SHIFT)/150, (1<<SHIFT)/2, (1<<SHIFT)/4, (1<<SHIFT)/8 )) >> SHIFT);
-		
-		// water
-		//int hue = 2100 + ((600 * fractal_noise( NUM(i) / 7, NUM(t)/60, ONE/2, ONE/4, ONE/8 )) >> SHIFT);
-		//int value = 750 + ((250*fractal_noise( ((i+41)<<SHIFT) / 20, (t<<SHIFT)/300, (1<<SHIFT)/2, (1<<SHIFT)/4, (1<<SHIFT)/8 )) >> SHIFT);
-		//int saturation = 500 + ((500*fractal_noise( ((i+129)<<SHIFT) / 9, (t<<SHIFT)/150, (1<<SHIFT)/2, (1<<SHIFT)/4, (1<<SHIFT)/8 )) >> SHIFT);
-
-		// begin to desaturate the color at a speed of 50 leds/sec. Fully desaturate at 50+50 leds/sec.
-		uint32_t color = hsv2(hue, saturation, value*brightness/1000);
-		led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM-1-i] = color;
-		led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM+i] = color;
+		// lava: hue 400 +- 200, value 600 +- 400, saturation 900 +- 100 (of 1000)
+		int index = clamp(0x8000 + ((0x7F80 * hue_noise[k]) >> SHIFT), 0, 0xFF00);
+		int value = clamp(154 + ((102 * value_noise[k]) >> SHIFT), 0, 256);
+		int saturation = clamp(230 + ((26 * saturation_noise[k]) >> SHIFT), 0, 256);
+
+		samples[k] = palette_scale(palette_desaturate(palette_lerp(lut, index), saturation), value);
 	}
+	put_samples(led_data, samples, step);
 }
 
-void ledpattern_bottom_water(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity, int brightness)
+void ledpattern_bottom_water(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity)
 {
 	(void) pos0;
 	(void) velocity;
 
-	for (int i=0; i<N_BOTTOM; i++)
+	const uint32_t *lut = palette_use(&palette_water);
+	int step = sample_step(WATER_STEP);
+	int n = n_samples(step);
+	int octaves = noise_octaves(3);
+	int32_t hue_noise[N_BOTTOM], value_noise[N_BOTTOM], saturation_noise[N_BOTTOM];
+	gnoise_row(hue_noise, n, 0, step * (ONE / 7), NUM(t)/60, octaves);
+	gnoise_row(value_noise, n, NUM(41) / 20, step * (ONE / 20), NUM(t)/300, octaves);
+	gnoise_row(saturation_noise, n, NUM(129) / 9, step * (ONE / 9), NUM(t)/150, octaves);
+
+	uint32_t samples[N_BOTTOM];
+	for (int k=0; k<n; k++)
 	{
-		// lava
-		//int hue = 400 + ((200 * fractal_noise( NUM(i) / 7, NUM(t)/60, ONE/2, ONE/4, ONE/8 )) >> SHIFT);
-		//int value = 600 + ((400*fractal_noise( ((i+41)<<SHIFT) / 20, (t<<SHIFT)/300, (1<<SHIFT)/2, (1<<SHIFT)/4, (1<<SHIFT)/8 )) >> SHIFT);
-		//int saturation = 900 + ((100*fractal_noise( ((i+129)<<SHIFT) / 9, (t<<SHIFT)/150, (1<<SHIFT)/2, (1<<SHIFT)/4, (1<<SHIFT)/8 )) >> SHIFT);
-		
-		// water
-		int hue = 2100 + ((600 * fractal_noise( NUM(i) / 7, NUM(t)/60, ONE/2, ONE/4, ONE/8 )) >> SHIFT);
-		int value = 750 + ((250*fractal_noise( ((i+41)<<SHIFT) / 20, (t<<SHIFT)/300, (1<<SHIFT)/2, (1<<SHIFT)/4, (1<<SHIFT)/8 )) >> SHIFT);
-		int saturation = 500 + ((500*fractal_noise( ((i+129)<<SHIFT) / 9, (t<<SHIFT)/150, (1<<SHIFT)/2, (1<<SHIFT)/4, (1<<SHIFT)/8 )) >> SHIFT);
-
-		// begin to desaturate the color at a speed of 50 leds/sec. Fully desaturate at 50+50 leds/sec.
-		uint32_t color = hsv2(hue, saturation, value*brightness/1000);
-		led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM-1-i] = color;
-		led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM+i] = color;
+		// water: hue 2100 +- 600, value 750 +- 250, saturation 500 +- 500 (of 1000)
+		int index = clamp(0x8000 + ((0x7F80 * hue_noise[k]) >> SHIFT), 0, 0xFF00);
+		int value = clamp(192 + ((64 * value_noise[k]) >> SHIFT), 0, 256);
+		int saturation = clamp(128 + ((128 * saturation_noise[k]) >> SHIFT), 0, 256);
+
+		samples[k] = palette_scale(palette_desaturate(palette_lerp(lut, index), saturation), value);
 	}
+	put_samples(led_data, samples, step);
 }
 
-void ledpattern_bottom_snake(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity, int brightness)
+void ledpattern_bottom_snake(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity)
 {
 	const int fulllength = ((2*N_BOTTOM)<<SHIFT);
 	const int snakelen = 10 << SHIFT;
@@ -293,9 +418,9 @@ void ledpattern_bottom_snake(volatile uint32_t led_data[], int t, fixed_t pos0,
 		int value = 0;
 	
 		if (snakehead <= currpos && currpos <= snakehead+snakelen)
-			value = snake_value(currpos, snakehead, snakelen, 2, brightness);
+			value = snake_value(currpos, snakehead, snakelen, 2, 1000);
 		if (snakehead - fulllength <= currpos && currpos <= snakehead+snakelen-fulllength)
-			value = snake_value(currpos, snakehead-fulllength, snakelen, 2, brightness);
+			value = snake_value(currpos, snakehead-fulllength, snakelen, 2, 1000);
 
 		uint32_t color = hsv2(hue, saturation, value);
 		led_data[N_SIDE+N_FRONT+N_SIDE+i] = color;
@@ -303,45 +428,57 @@ void ledpattern_bottom_snake(volatile uint32_t led_data[], int t, fixed_t pos0,
 }
 
 
-void ledpattern_bottom_position_color(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity, int brightness)
+void ledpattern_bottom_position_color(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity)
 {
 	(void) t;
 	(void) velocity;
 
-	for (int i=0; i<N_BOTTOM; i++)
-	{
-		int hue = (pos0*12)>>SHIFT;
-		// begin to desaturate the color at a speed of 50 leds/sec. Fully desaturate at 50+50 leds/sec.
-		uint32_t color = hsv2(hue, 1000, brightness);
-		led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM-1-i] = color;
-		led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM+i] = color;
-	}
+	// the same colour on all LEDs
+	int hue = ((pos0*12)>>SHIFT) % 3600;
+	uint32_t color = hsv2(hue, 1000, 1000);
+	for (int i=0; i<2*N_BOTTOM; i++)
+		led_data[N_SIDE+N_FRONT+N_SIDE+i] = color;
 }
 
-void ledpattern_bottom_rainbow(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity, int brightness)
+/* the hue advances by 120 per LED */
+#define RAINBOW_PERIOD 30
+
+struct rainbow_state
+{
+	uint32_t texture[RAINBOW_PERIOD];
+};
+
+static void rainbow_init(void *state)
+{
+	struct rainbow_state *s = state;
+	for (int i=0; i<RAINBOW_PERIOD; i++)
+		s->texture[i] = hsv2(i * 120, 1000, 1000);
+}
+
+void ledpattern_bottom_rainbow(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity)
 {
 	(void) t; // unused
 
-	for (int i=0; i<N_BOTTOM; i++)
-	{
-		fixed_t pos = (i << SHIFT) + pos0;
-		int hue = (pos*120)>>SHIFT;
+	struct rainbow_state *state = BOTTOM_STATE;
+	put_texture(led_data, state->texture, RAINBOW_PERIOD, pos0);
 
-		// begin to desaturate the color at a speed of 50 leds/sec. Fully desaturate at 50+50 leds/sec.
-		int saturation = 1000 - clamp( ((velocity - (50<<SHIFT) ) * 1000 / 50) >> SHIFT, 0, 1000);
-		uint32_t color = hsv2(hue, saturation, brightness);
-		led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM-1-i] = color;
-		led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM+i] = color;
-	}
+	// begin to desaturate the color at a speed of 50 leds/sec. Fully desaturate at 50+50 leds/sec.
+	ledpattern_bottom_saturation = 1000 - clamp( ((velocity - (50<<SHIFT) ) * 1000 / 50) >> SHIFT, 0, 1000);
 }
 
-void ledpattern_bottom_velocity_color(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity, int brightness)
+struct velocity_color_state
 {
-	(void) pos0; // unused
+	fixed_t velocity_saved;
+	int value_smooth;
+};
 
-	static fixed_t velocity_saved = 0;
+void ledpattern_bottom_velocity_color(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity)
+{
+	(void) pos0; // unused
 
-	if (velocity > 0) velocity_saved = velocity;
+	struct velocity_color_state *state = BOTTOM_STATE;
+	if (velocity > 0) state->velocity_saved = velocity;
+	fixed_t velocity_saved = state->velocity_saved;
 
 	int base_hue = t*(3600/600) / FPS; // one full color revolution per 10 minutes
 	int velo_hue = 3600 * (velocity_saved / 200) >> SHIFT; // 200 ledunits per sec makes one full color revolution
@@ -350,10 +487,9 @@ void ledpattern_bottom_velocity_color(volatile uint32_t led_data[], int t, fixed
 
 	//int instant_value = (velocity >> SHIFT) > 5 ? 1000 : 0;
 	int instant_value = clamp((1000 * (velocity - (10<<SHIFT)) / 90) >> SHIFT, 0, 1000);
-	static int value_smooth = 0;
-	value_smooth += (instant_value - value_smooth) / 30;
+	state->value_smooth += (instant_value - state->value_smooth) / 30;
 	
-	uint32_t color = hsv2(base_hue + velo_hue, saturation, value_smooth * brightness / 1000);
+	uint32_t color = hsv2(base_hue + velo_hue, saturation, state->value_smooth);
 
 	for (int i=0; i<N_BOTTOM; i++)
 	{
@@ -362,24 +498,205 @@ void ledpattern_bottom_velocity_color(volatile uint32_t led_data[], int t, fixed
 	}
 }
 
-ledpattern_bottom_t ledpatterns_bottom[N_BOTTOM_PATTERNS] = {
-	ledpattern_bottom_rainbow,
-	ledpattern_bottom_dots,
-	ledpattern_bottom_3color,
-	ledpattern_bottom_water,
-	ledpattern_bottom_lava,
-	ledpattern_bottom_snake,
-	ledpattern_bottom_position_color,
-	ledpattern_bottom_velocity_color
+static void pov_init(void *state)
+{
+	struct pov_cursor *cursor = state;
+	cursor->image = &pov_image_lane;
+}
+
+void ledpattern_bottom_pov(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity)
+{
+	(void) t;
+
+	struct pov_cursor *cursor = BOTTOM_STATE;
+	struct pov_frame frame;
+	pov_frame(&frame, cursor->image, pos0, velocity);
+	pov_render(led_data, cursor, pov_predict(&frame, 0));
+}
+
+/* one spark per SPARK_DISTANCE LED units travelled */
+#define SPARK_DISTANCE 2
+
+struct sparks_state
+{
+	struct particles sparks;
+	int32_t distance;
 };
 
-ledpattern_front_t ledpatterns_front[N_FRONT_PATTERNS] = {
-	ledpattern_front_bat_and_slow_info,
-	ledpattern_front_bat_and_slow_info2,
-	ledpattern_front_bat_and_slow_info3,
-	ledpattern_front_bat_and_slow_info4,
-	ledpattern_front_knightrider,
-	ledpattern_front_knightrider2,
-	ledpattern_front_knightrider3,
-	ledpattern_front_knightrider4
+static void sparks_init(void *state)
+{
+	struct sparks_state *s = state;
+	particles_init(&s->sparks, 0x5eed);
+}
+
+void ledpattern_bottom_sparks(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity)
+{
+	(void) t;
+	(void) pos0;
+
+	struct sparks_state *state = BOTTOM_STATE;
+	struct particles *sparks = &state->sparks;
+
+	// sparks start at the front end and fly backwards, slower than the road
+	int32_t road = velocity / FPS;
+	state->distance += road;
+	while (state->distance >= SPARK_DISTANCE * ONE)
+	{
+		state->distance -= SPARK_DISTANCE * ONE;
+		uint32_t r = particles_random(sparks);
+		int32_t spark_velocity = -(int32_t)(((int64_t)road * (128 + (r & 127))) >> 8);
+		uint32_t color = hsv2(100 + (r >> 8) % 400, 600 + (r >> 16) % 400, 1000);
+		particles_emit(sparks, (N_BOTTOM-1) * ONE, spark_velocity, color, 10 + (r >> 24) % 40);
+	}
+	particles_update(sparks);
+
+	for (int i=0; i<N_BOTTOM; i++)
+	{
+		led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM-1-i] = 0;
+		led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM+i] = 0;
+	}
+	particles_render(sparks, led_data);
+}
+
+/* generated by 'python3 vmc.py plasma.vm --c vm_plasma' in ../host */
+static const uint8_t vm_plasma[97] = {
+	0x56, 0x01, 0x20, 0x00, 0x3b, 0x00, 0x01, 0x0f, 0x00, 0x40, 0x00, 0x00,
+	0x07, 0x01, 0x01, 0x0f, 0x55, 0x55, 0x00, 0x00, 0x07, 0x02, 0x01, 0x0f,
+	0xcd, 0x0c, 0x00, 0x00, 0x07, 0x03, 0x01, 0x0f, 0x00, 0x80, 0x00, 0x00,
+	0x07, 0x04, 0x02, 0x00, 0x08, 0x07, 0x00, 0x06, 0x00, 0x0f, 0xb1, 0x13,
+	0x00, 0x00, 0x06, 0x01, 0x08, 0x14, 0x06, 0x00, 0x0f, 0x92, 0x24, 0x00,
+	0x00, 0x06, 0x02, 0x09, 0x14, 0x08, 0x0f, 0x00, 0x40, 0x00, 0x00, 0x06,
+	0x03, 0x08, 0x18, 0x00, 0x06, 0x00, 0x0f, 0x33, 0x33, 0x00, 0x00, 0x06,
+	0x04, 0x15, 0x0f, 0x66, 0x66, 0x00, 0x00, 0x0e, 0x9a, 0x99, 0x00, 0x00,
+	0x19,
 };
+
+int ledpattern_brightness = 1000;
+static const uint8_t *vm_programs[VM_SLOTS] = { vm_plasma, vm_plasma };
+
+void ledpattern_vm_load(int slot, const uint8_t *program)
+{
+	vm_programs[slot] = program ? program : vm_plasma;
+}
+
+void ledpattern_bottom_vm0(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity)
+{
+	vm_run(vm_programs[0], led_data, t, pos0, velocity, ledpattern_brightness);
+}
+
+void ledpattern_bottom_vm1(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity)
+{
+	vm_run(vm_programs[1], led_data, t, pos0, velocity, ledpattern_brightness);
+}
+
+void ledpattern_bottom_brake(volatile uint32_t led_data[], int t)
+{
+	// flash for half a second, then stay lit
+	uint32_t color = (t >= FPS/2 || (t / 5) % 2 == 0) ? BRAKE_COLOR : 0;
+
+	for (int i=0; i<N_BOTTOM; i++)
+	{
+		led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM-1-i] = color;
+		led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM+i] = color;
+	}
+}
+
+/* The selectable patterns, in the order the button cycles through them. With
+ * 'make PATTERNS=...', only the listed ones are registered, see ledpattern.h. */
+
+#if !defined(LEDPATTERNS_SELECT) || defined(LEDPATTERN_rainbow)
+LEDPATTERN_BOTTOM(rainbow, LEDPATTERN_COST_LOW, 1, LEDPATTERN_IN_POSITION | LEDPATTERN_IN_VELOCITY,
+	sizeof(struct rainbow_state), rainbow_init, NULL);
+#endif
+#if !defined(LEDPATTERNS_SELECT) || defined(LEDPATTERN_dots)
+LEDPATTERN_BOTTOM(dots, LEDPATTERN_COST_MEDIUM, 1, LEDPATTERN_IN_TIME | LEDPATTERN_IN_POSITION | LEDPATTERN_IN_VELOCITY,
+	sizeof(struct dots_state), NULL, NULL);
+#endif
+#if !defined(LEDPATTERNS_SELECT) || defined(LEDPATTERN_3color)
+LEDPATTERN_BOTTOM(3color, LEDPATTERN_COST_LOW, 1, LEDPATTERN_IN_POSITION,
+	sizeof(struct threecolor_state), threecolor_init, NULL);
+#endif
+#if !defined(LEDPATTERNS_SELECT) || defined(LEDPATTERN_water)
+LEDPATTERN_BOTTOM(water, LEDPATTERN_COST_HIGH, WATER_STEP, LEDPATTERN_IN_TIME,
+	0, NULL, NULL);
+#endif
+#if !defined(LEDPATTERNS_SELECT) || defined(LEDPATTERN_lava)
+LEDPATTERN_BOTTOM(lava, LEDPATTERN_COST_HIGH, LAVA_STEP, LEDPATTERN_IN_TIME,
+	0, NULL, NULL);
+#endif
+#if !defined(LEDPATTERNS_SELECT) || defined(LEDPATTERN_snake)
+LEDPATTERN_BOTTOM(snake, LEDPATTERN_COST_MEDIUM, 1, LEDPATTERN_IN_TIME,
+	0, NULL, NULL);
+#endif
+#if !defined(LEDPATTERNS_SELECT) || defined(LEDPATTERN_position_color)
+LEDPATTERN_BOTTOM(position_color, LEDPATTERN_COST_LOW, 1, LEDPATTERN_IN_POSITION,
+	0, NULL, NULL);
+#endif
+#if !defined(LEDPATTERNS_SELECT) || defined(LEDPATTERN_velocity_color)
+LEDPATTERN_BOTTOM(velocity_color, LEDPATTERN_COST_LOW, 1, LEDPATTERN_IN_TIME | LEDPATTERN_IN_VELOCITY,
+	sizeof(struct velocity_color_state), NULL, NULL);
+#endif
+#if !defined(LEDPATTERNS_SELECT) || defined(LEDPATTERN_pov)
+LEDPATTERN_BOTTOM(pov, LEDPATTERN_COST_LOW, 1, LEDPATTERN_IN_POSITION | LEDPATTERN_IN_REFRESH,
+	sizeof(struct pov_cursor), pov_init, NULL);
+#endif
+#if !defined(LEDPATTERNS_SELECT) || defined(LEDPATTERN_sparks)
+LEDPATTERN_BOTTOM(sparks, LEDPATTERN_COST_MEDIUM, 1, LEDPATTERN_IN_VELOCITY,
+	sizeof(struct sparks_state), sparks_init, NULL);
+#endif
+#if !defined(LEDPATTERNS_SELECT) || defined(LEDPATTERN_vm0)
+LEDPATTERN_BOTTOM(vm0, LEDPATTERN_COST_HIGH, 1, LEDPATTERN_IN_TIME | LEDPATTERN_IN_POSITION | LEDPATTERN_IN_VELOCITY | LEDPATTERN_IN_BRIGHTNESS,
+	0, NULL, NULL);
+#endif
+#if !defined(LEDPATTERNS_SELECT) || defined(LEDPATTERN_vm1)
+LEDPATTERN_BOTTOM(vm1, LEDPATTERN_COST_HIGH, 1, LEDPATTERN_IN_TIME | LEDPATTERN_IN_POSITION | LEDPATTERN_IN_VELOCITY | LEDPATTERN_IN_BRIGHTNESS,
+	0, NULL, NULL);
+#endif
+
+#if !defined(LEDPATTERNS_SELECT) || defined(LEDPATTERN_bat_and_slow_info)
+LEDPATTERN_FRONT(bat_and_slow_info, LEDPATTERN_COST_MEDIUM, LEDPATTERN_IN_TIME | LEDPATTERN_IN_BATTERY,
+	sizeof(struct bat_and_slow_info_state), NULL, NULL);
+#endif
+#if !defined(LEDPATTERNS_SELECT) || defined(LEDPATTERN_bat_and_slow_info2)
+LEDPATTERN_FRONT(bat_and_slow_info2, LEDPATTERN_COST_MEDIUM, LEDPATTERN_IN_TIME | LEDPATTERN_IN_BATTERY,
+	sizeof(struct bat_and_slow_info_state), NULL, NULL);
+#endif
+#if !defined(LEDPATTERNS_SELECT) || defined(LEDPATTERN_bat_and_slow_info3)
+LEDPATTERN_FRONT(bat_and_slow_info3, LEDPATTERN_COST_MEDIUM, LEDPATTERN_IN_TIME | LEDPATTERN_IN_BATTERY,
+	sizeof(struct bat_and_slow_info_state), NULL, NULL);
+#endif
+#if !defined(LEDPATTERNS_SELECT) || defined(LEDPATTERN_bat_and_slow_info4)
+LEDPATTERN_FRONT(bat_and_slow_info4, LEDPATTERN_COST_MEDIUM, LEDPATTERN_IN_TIME | LEDPATTERN_IN_BATTERY,
+	sizeof(struct bat_and_slow_info_state), NULL, NULL);
+#endif
+#if !defined(LEDPATTERNS_SELECT) || defined(LEDPATTERN_knightrider)
+LEDPATTERN_FRONT(knightrider, LEDPATTERN_COST_MEDIUM, LEDPATTERN_IN_TIME,
+	0, NULL, NULL);
+#endif
+#if !defined(LEDPATTERNS_SELECT) || defined(LEDPATTERN_knightrider2)
+LEDPATTERN_FRONT(knightrider2, LEDPATTERN_COST_MEDIUM, LEDPATTERN_IN_TIME,
+	0, NULL, NULL);
+#endif
+#if !defined(LEDPATTERNS_SELECT) || defined(LEDPATTERN_knightrider3)
+LEDPATTERN_FRONT(knightrider3, LEDPATTERN_COST_MEDIUM, LEDPATTERN_IN_TIME,
+	0, NULL, NULL);
+#endif
+#if !defined(LEDPATTERNS_SELECT) || defined(LEDPATTERN_knightrider4)
+LEDPATTERN_FRONT(knightrider4, LEDPATTERN_COST_MEDIUM, LEDPATTERN_IN_TIME,
+	0, NULL, NULL);
+#endif
+
+/* main.c needs at least one pattern of each kind. Without, ld would only complain
+ * about an undefined __start_ledpatterns_bottom or __start_ledpatterns_front. */
+#if defined(LEDPATTERNS_SELECT) && !(defined(LEDPATTERN_rainbow) || defined(LEDPATTERN_dots) || \
+	defined(LEDPATTERN_3color) || defined(LEDPATTERN_water) || defined(LEDPATTERN_lava) || \
+	defined(LEDPATTERN_snake) || defined(LEDPATTERN_position_color) || defined(LEDPATTERN_velocity_color) || \
+	defined(LEDPATTERN_pov) || defined(LEDPATTERN_sparks) || defined(LEDPATTERN_vm0) || defined(LEDPATTERN_vm1))
+#error "PATTERNS lists no bottom pattern"
+#endif
+#if defined(LEDPATTERNS_SELECT) && !(defined(LEDPATTERN_bat_and_slow_info) || defined(LEDPATTERN_bat_and_slow_info2) || \
+	defined(LEDPATTERN_bat_and_slow_info3) || defined(LEDPATTERN_bat_and_slow_info4) || \
+	defined(LEDPATTERN_knightrider) || defined(LEDPATTERN_knightrider2) || \
+	defined(LEDPATTERN_knightrider3) || defined(LEDPATTERN_knightrider4))
+#error "PATTERNS lists no front pattern"
+#endif
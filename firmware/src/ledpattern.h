@@ -5,20 +5,158 @@
 void ledpattern_bat_empty(volatile uint32_t led_data[], int t, int batt_cells);
 
 void ledpattern_front_bat_and_slow_info(volatile uint32_t led_data[], int t, int batt_cells, int batt_percent, int slow_warning);
+void ledpattern_front_bat_and_slow_info2(volatile uint32_t led_data[], int t, int batt_cells, int batt_percent, int slow_warning);
+void ledpattern_front_bat_and_slow_info3(volatile uint32_t led_data[], int t, int batt_cells, int batt_percent, int slow_warning);
+void ledpattern_front_bat_and_slow_info4(volatile uint32_t led_data[], int t, int batt_cells, int batt_percent, int slow_warning);
 void ledpattern_front_knightrider(volatile uint32_t led_data[], int t, int batt_cells, int batt_percent, int slow_warning);
+void ledpattern_front_knightrider2(volatile uint32_t led_data[], int t, int batt_cells, int batt_percent, int slow_warning);
+void ledpattern_front_knightrider3(volatile uint32_t led_data[], int t, int batt_cells, int batt_percent, int slow_warning);
+void ledpattern_front_knightrider4(volatile uint32_t led_data[], int t, int batt_cells, int batt_percent, int slow_warning);
 
-void ledpattern_bottom_3color(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity, int brightness);
-void ledpattern_bottom_rainbow(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity, int brightness);
-void ledpattern_bottom_velocity_color(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity, int brightness);
-void ledpattern_bottom_position_color(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity, int brightness);
-void ledpattern_bottom_water(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity, int brightness);
-void ledpattern_bottom_snake(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity, int brightness);
+void ledpattern_bottom_3color(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity);
+void ledpattern_bottom_rainbow(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity);
+void ledpattern_bottom_velocity_color(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity);
+void ledpattern_bottom_position_color(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity);
+void ledpattern_bottom_water(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity);
+void ledpattern_bottom_snake(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity);
+void ledpattern_bottom_dots(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity);
+void ledpattern_bottom_lava(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity);
 
-typedef void (*ledpattern_bottom_t)(volatile uint32_t[], int, fixed_t, fixed_t, int);
-#define N_BOTTOM_PATTERNS 8
-extern ledpattern_bottom_t ledpatterns_bottom[N_BOTTOM_PATTERNS];
+/** Sparks thrown off the road, more of them the faster the ride (see particles.h) */
+void ledpattern_bottom_sparks(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity);
 
+/** Run the bytecode program of their slot (see vm.h) */
+void ledpattern_bottom_vm0(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity);
+void ledpattern_bottom_vm1(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity);
+
+/** Sets the program of a vm pattern. It must have passed vm_check(). NULL selects
+  * the built-in program, which runs until a program has been uploaded. */
+void ledpattern_vm_load(int slot, const uint8_t *program);
+
+/** Paints an image onto the road (see pov.h). On the target, the WS2812 driver
+  * repaints it between the frames, see main.c. */
+void ledpattern_bottom_pov(volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity);
+
+/** Brake light on the bottom strips. t counts the frames since braking was detected */
+void ledpattern_bottom_brake(volatile uint32_t led_data[], int t);
+
+/** Saturation (0..1000) that the output stage applies to the bottom strips, see
+  * output_set_bottom(). Set it to 1000 before calling a bottom pattern; patterns
+  * that desaturate their colours with the speed (rainbow) lower it. */
+extern int ledpattern_bottom_saturation;
+
+/** The user's brightness (0..1000), an input of the vm patterns. The output stage
+  * applies it, the other patterns ignore it. */
+extern int ledpattern_brightness;
+
+/* Pattern registry
+ *
+ * Every selectable pattern registers a descriptor with LEDPATTERN_BOTTOM() or
+ * LEDPATTERN_FRONT(), see the end of ledpattern.c. The descriptors end up in the linker
+ * sections ledpatterns_bottom and ledpatterns_front, which ld places in flash and
+ * delimits with __start_<section> and __stop_<section>; there is no hand-kept table.
+ * ledpattern.c is compiled with -fno-toplevel-reorder, so the button cycles through
+ * the patterns in the order of their registration.
+ *
+ * 'make PATTERNS="rainbow lava knightrider"' only registers the listed patterns
+ * (at least one bottom and one front pattern); --gc-sections then drops the others.
+ *
+ * Patterns keep their state in a scratch arena instead of static variables. The
+ * active front pattern owns its first LEDPATTERN_ARENA_FRONT bytes, the active
+ * bottom pattern the rest. ledpattern_*_activate() deinitializes the previous
+ * pattern, zeroes state_size bytes and calls the new pattern's init hook, so a
+ * pattern starts afresh every time it is selected. The registration fails to
+ * compile if a state does not fit; 'build/golden arena' reports the sizes.
+ *
+ * Usage:
+ *   - ledpattern_bottom_activate(p) and ledpattern_front_activate(p) before the
+ *     first frame and whenever the selection changes
+ *   - ledpatterns_bottom[p].render(...) and ledpatterns_front[p].render(...) every frame
+ */
+
+#define LEDPATTERN_ARENA_SIZE 1536
+#define LEDPATTERN_ARENA_FRONT 32
+#define LEDPATTERN_ARENA_BOTTOM (LEDPATTERN_ARENA_SIZE - LEDPATTERN_ARENA_FRONT)
+
+enum ledpattern_cost
+{
+	LEDPATTERN_COST_LOW,    // a texture or a single colour, < 1% of a frame at 72 MHz
+	LEDPATTERN_COST_MEDIUM, // some arithmetic per LED
+	LEDPATTERN_COST_HIGH    // noise or bytecode per LED, needs 72 MHz and the quality levels
+};
+
+/* inputs a pattern depends on, besides led_data */
+#define LEDPATTERN_IN_TIME       0x01
+#define LEDPATTERN_IN_POSITION   0x02
+#define LEDPATTERN_IN_VELOCITY   0x04
+#define LEDPATTERN_IN_BATTERY    0x08 // batt_cells, batt_percent and slow_warning
+#define LEDPATTERN_IN_BRIGHTNESS 0x10 // ledpattern_brightness
+#define LEDPATTERN_IN_REFRESH    0x20 // is repainted before every WS2812 refresh, see main.c
+
+typedef void (*ledpattern_bottom_t)(volatile uint32_t[], int, fixed_t, fixed_t);
 typedef void (*ledpattern_front_t)(volatile uint32_t[], int , int, int, int);
-#define N_FRONT_PATTERNS 8
-extern ledpattern_front_t ledpatterns_front[N_FRONT_PATTERNS];
+typedef void (*ledpattern_hook_t)(void *state);
+
+struct ledpattern_bottom
+{
+	ledpattern_bottom_t render;
+	const char *name;
+	uint8_t cost;   // enum ledpattern_cost
+	uint8_t step;   // spatial step: evaluated at every step-th LED and interpolated in between
+	uint8_t inputs; // LEDPATTERN_IN_*
+	uint16_t state_size;     // bytes of the arena
+	ledpattern_hook_t init;  // called on activation with the zeroed state, or NULL
+	ledpattern_hook_t deinit; // called when another pattern is activated, or NULL
+};
+
+struct ledpattern_front
+{
+	ledpattern_front_t render;
+	const char *name;
+	uint8_t cost;
+	uint8_t inputs;
+	uint16_t state_size;
+	ledpattern_hook_t init;
+	ledpattern_hook_t deinit;
+};
+
+#define LEDPATTERN_DESCRIPTOR(type, name, state_size, limit) \
+	typedef char ledpattern_##type##_##name##_state_fits[(state_size) <= (limit) ? 1 : -1]; \
+	static const struct ledpattern_##type ledpattern_##type##_##name##_descriptor \
+	__attribute__((used, section("ledpatterns_" #type), aligned(__alignof__(struct ledpattern_##type))))
+
+/** Registers ledpattern_bottom_<name>() as "<name>" */
+#define LEDPATTERN_BOTTOM(name, cost, step, inputs, state_size, init, deinit) \
+	LEDPATTERN_DESCRIPTOR(bottom, name, state_size, LEDPATTERN_ARENA_BOTTOM) = \
+	{ ledpattern_bottom_##name, #name, cost, step, inputs, state_size, init, deinit }
+
+/** Registers ledpattern_front_<name>() as "<name>" */
+#define LEDPATTERN_FRONT(name, cost, inputs, state_size, init, deinit) \
+	LEDPATTERN_DESCRIPTOR(front, name, state_size, LEDPATTERN_ARENA_FRONT) = \
+	{ ledpattern_front_##name, #name, cost, inputs, state_size, init, deinit }
+
+extern const struct ledpattern_bottom __start_ledpatterns_bottom[], __stop_ledpatterns_bottom[];
+extern const struct ledpattern_front __start_ledpatterns_front[], __stop_ledpatterns_front[];
+
+/** The registered patterns, in registration order */
+#define ledpatterns_bottom __start_ledpatterns_bottom
+#define ledpatterns_front __start_ledpatterns_front
+#define N_BOTTOM_PATTERNS ((int)(__stop_ledpatterns_bottom - __start_ledpatterns_bottom))
+#define N_FRONT_PATTERNS ((int)(__stop_ledpatterns_front - __start_ledpatterns_front))
+
+/** Hands the arena over to pattern p, see above */
+void ledpattern_bottom_activate(int p);
+void ledpattern_front_activate(int p);
+
+/** Upper limit for all steps. 1 renders at full resolution, e.g. as the
+  * reference for the quality metric (see ../host/golden.c). */
+extern int ledpattern_max_step;
+
+/** Quality level of the bottom patterns, from 0 (full) to LEDPATTERN_LOWEST_QUALITY.
+  * The frame budget lowers it when frames overrun (see framebudget.h). Level 1 drops
+  * one noise octave, level 2 doubles the spatial steps. At level 3, the caller
+  * renders the bottom strips only every second frame. */
+#define LEDPATTERN_LOWEST_QUALITY 3
+extern int ledpattern_quality;
+
 
@@ -32,7 +32,6 @@
 #include <libopencm3/stm32/dma.h>
 #include <libopencm3/cm3/nvic.h>
 #include <libopencm3/stm32/timer.h>
-#include <libopencm3/cm3/cortex.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -46,6 +45,22 @@
 #include "common.h"
 #include "math.h"
 #include "ledpattern.h"
+#include "odometer.h"
+#include "sensors.h"
+#include "output.h"
+#include "powerlimit.h"
+#include "power.h"
+#include "clock.h"
+#include "governor.h"
+#include "framebudget.h"
+#include "pov.h"
+#include "vm.h"
+#include "vmstore.h"
+
+#include <libopencm3/cm3/dwt.h>
+#ifdef BENCH
+#include "bench.h"
+#endif
 
 #define ADC_MAX 4095
 #define ADC_VREF_MILLIVOLTS 3300
@@ -58,12 +73,21 @@
 
 static void clock_setup(void)
 {
-	rcc_clock_setup_in_hse_8mhz_out_72mhz();
+	clock_init();
 	rcc_periph_clock_enable(RCC_GPIOC); // LED
 	rcc_periph_clock_enable(RCC_GPIOB); // button
 }
 
 
+static uint16_t animation_prescaler(void)
+{
+	return clock_mhz * 1000000LL / (FPS * 65536LL) - 1;
+}
+
+/* core cycles per TIM2 tick (a frame has 65536 ticks), updated together with the
+ * prescaler, so that the WS2812 interrupt does not need to divide in 64 bits */
+static volatile uint32_t animation_tick_cycles;
+
 static void animation_init(void)
 {
 	rcc_periph_clock_enable(RCC_TIM2);
@@ -74,7 +98,8 @@ static void animation_init(void)
 	timer_disable_preload(TIM2);
 	timer_continuous_mode(TIM2);
 	timer_set_period(TIM2, 0xFFFF); // full scale
-	timer_set_prescaler(TIM2, 72000000LL / (FPS * 65536LL) - 1); // 60 fps update rate FIXME
+	animation_tick_cycles = animation_prescaler() + 1;
+	timer_set_prescaler(TIM2, animation_prescaler()); // 60 fps update rate FIXME
 
 	// Configure the interrupts
 	nvic_enable_irq(NVIC_TIM2_IRQ);
@@ -95,25 +120,91 @@ const double LED_DISTANCE_MM = 17.5;
 
 const fixed_t WHEEL_CIRCUMFERENCE_LEDUNITS = (1<<SHIFT) * WHEEL_CIRCUMFERENCE_MM / LED_DISTANCE_MM;
 
+static struct odometer odometer;
+static struct powerlimit powerlimit;
+static struct governor governor;
+static struct framebudget framebudget;
+static volatile enum clock_mode clock_request = CLOCK_72MHZ;
+static volatile uint32_t clock_switches = 0;
+
+/* after 3 minutes without movement, fade out for a second and enter STOP mode */
+#define PARK_FRAMES (3 * 60 * FPS)
+#define PARK_FADE_FRAMES FPS
+
+enum park_state { PARK_RUNNING, PARK_REQUESTED, PARK_RESUMED };
+static volatile enum park_state park_state = PARK_RUNNING;
+
+/** Scales all LEDs by permille */
+static void fade_out(int permille)
+{
+	for (int i=0; i<LED_COUNT; i++)
+	{
+		uint32_t c = led_data[i];
+		led_data[i] = ((((c >> 16) & 0xFF) * permille / 1000) << 16) |
+			((((c >> 8) & 0xFF) * permille / 1000) << 8) |
+			((c & 0xFF) * permille / 1000);
+	}
+}
+
+/* the POV pattern's position as of the last frame, and the frame's start in core
+ * cycles. Double-buffered, because the refresh hook interrupts the renderer. */
+static struct pov_frame pov_frames[2];
+static uint32_t pov_frame_start[2];
+static volatile int pov_frame_idx = 0;
+
+/* The refresh hook's decoder position. It cannot share the cursor in the pattern's
+ * state, which the hook may interrupt in the middle of an update. The renderer
+ * resets both whenever it installs the hook, i.e. when the pattern is activated or
+ * takes the bottom strips back from the brake light or the empty battery. */
+static struct pov_cursor pov_refresh_cursor;
+static int32_t pov_painted; // column painted last
+
+/** Repaints the POV image at the start of every WS2812 refresh, at the position
+  * predicted for this point of the frame. Runs in the DMA interrupt. */
+static void pov_refresh(void)
+{
+	// a frame has 65536 TIM2 ticks
+	int idx = pov_frame_idx;
+	uint32_t fraction = (dwt_read_cycle_counter() - pov_frame_start[idx]) / animation_tick_cycles;
+
+	// only repaint if the image has moved by at least one column
+	int32_t column = pov_predict(&pov_frames[idx], fraction);
+	if (column == pov_painted)
+		return;
+	pov_painted = column;
+	pov_render(led_data, &pov_refresh_cursor, column);
+}
+
+/** Samples and debounces the user button and publishes its state */
+static void button_poll(void)
+{
+	static int button_debounce = 0;
+	int button_pressed_raw = !!gpio_get(GPIOB, GPIO10);
+	button_debounce = (button_debounce << 1) | button_pressed_raw;
+	sensors_publish_button((button_debounce & 0x0F) != 0);
+}
 
 void tim2_isr(void)
 {
 	/* slow_warning is usually 0. It's set to >0, when the ISR hasn't finished in time */
 	static int slow_warning = 120;
+	uint32_t frame_start = dwt_read_cycle_counter();
 	if (slow_warning > 0) slow_warning--;
 
 	/* frame counter */
 	static int t = 1000; // the offset does not really matter. however, we're subtracting from t at some places, and we don't want these calculations to become negative.
 	t++;
 
-	cm_disable_interrupts();
-	uint32_t frequency_millihertz_copy = frequency_millihertz;
-	cm_enable_interrupts();
+	tacho_update();
+	adc_poll();
+	button_poll();
+
+	struct sensor_state sensors;
+	sensors_snapshot(&sensors);
 
-	static int distance = 0; // increases by FPS*1000 = 60000 per wheel revolution
-	distance += frequency_millihertz_copy;
+	odometer_advance(&odometer, sensors.frequency_millihertz);
 
-	fixed_t velocity = ((fixed_t)frequency_millihertz_copy) * WHEEL_CIRCUMFERENCE_LEDUNITS / FREQUENCY_FACTOR; // = ledunits per second
+	fixed_t velocity = ((fixed_t)sensors.frequency_millihertz) * WHEEL_CIRCUMFERENCE_LEDUNITS / FREQUENCY_FACTOR; // = ledunits per second
 
 	static int batt_percent = 1;
 	static int batt_empty = 0;
@@ -127,31 +218,35 @@ void tim2_isr(void)
 
 	gpio_toggle(GPIOC, GPIO13);	/* LED on/off */
 
-	adc_poll();
 	if (t % 100 == 0)
 	{
-		if (adc_value > 0)
+		if (sensors.adc_value > 0)
 		{
-			int batt_millivolts = ADC_VREF_MILLIVOLTS * adc_value * (BAT_R1+BAT_R2) / ADC_MAX / BAT_R1;
+			int batt_millivolts = ADC_VREF_MILLIVOLTS * sensors.adc_value * (BAT_R1+BAT_R2) / ADC_MAX / BAT_R1;
 			batt_percent = batt_get_percent(batt_millivolts);
-			//printf("adc value: %d = %d mV -> %d %%\n", adc_value, batt_millivolts, batt_percent);
+			//printf("adc value: %d = %d mV -> %d %%\n", sensors.adc_value, batt_millivolts, batt_percent);
 		}
 	}
 
 
 	/* handle the user button */
-	static int button_debounce = 0;
-	int button_pressed_raw = !!gpio_get(GPIOB, GPIO10);
-	button_debounce = (button_debounce << 1) | button_pressed_raw;
-	int button_pressed = (button_debounce & 0x0F) != 0;
-
 	static int brightness = 1000;
 	static int brightness_direction = -1;
 	static int button_press_time = 0;
-	static int ledpattern_bottom_idx = 0;
-	static int ledpattern_front_idx = 2;
+	static int ledpattern_bottom_idx = -1;
+	static int ledpattern_front_idx = -1;
+
+	if (ledpattern_bottom_idx < 0)
+	{
+		// the defaults. 'make PATTERNS=...' may register a single front pattern
+		// (but at least one, see ledpattern.c), so the index must wrap.
+		ledpattern_bottom_idx = 0;
+		ledpattern_front_idx = 2 % N_FRONT_PATTERNS;
+		ledpattern_bottom_activate(ledpattern_bottom_idx);
+		ledpattern_front_activate(ledpattern_front_idx);
+	}
 
-	if (button_pressed)
+	if (sensors.button_pressed)
 	{
 		button_press_time++;
 
@@ -172,22 +267,43 @@ void tim2_isr(void)
 		{
 			printf("switch ledpattern\n");
 			ledpattern_bottom_idx = (ledpattern_bottom_idx + 1) % N_BOTTOM_PATTERNS;
+			ledpattern_bottom_activate(ledpattern_bottom_idx);
 		}
 		else if (button_press_time < FPS) // < 1 sec?
 		{
 			printf("switch frontpattern\n");
 			ledpattern_front_idx = (ledpattern_front_idx + 1) % N_FRONT_PATTERNS;
+			ledpattern_front_activate(ledpattern_front_idx);
 		}
 
 		button_press_time = 0;
 	}
 
+	/* keep the LED current below the cap, which drops as the battery empties */
+	int limit = powerlimit_update(&powerlimit, sensors.led_current_fixed_ma, sensors.led_current_scaled_ma, powerlimit_cap_ma(batt_percent));
+	static bool limiting = false;
+	if ((limit < 1000) != limiting)
+	{
+		limiting = limit < 1000;
+		if (limiting)
+			printf("power limit: %d permille, %d + %d mA\n", limit, sensors.led_current_fixed_ma, sensors.led_current_scaled_ma);
+		else
+			printf("power limit: off\n");
+	}
 
-	fixed_t pos0 = distance * WHEEL_CIRCUMFERENCE_LEDUNITS / (FPS*FREQUENCY_FACTOR);
+	fixed_t pos0 = odometer_position(&odometer);
 
+#ifdef RECORD_RIDE
+	// for ../host/golden.c. newlib-nano's printf has no %lld, so pos0 is printed as two hex halves
+	printf("ride %d %08lx%08lx %ld %d\n", t, (unsigned long)((uint64_t)pos0 >> 32), (unsigned long)(pos0 & 0xFFFFFFFF), (long)velocity, brightness);
+#endif
+
+	/* at the lowest quality level, the bottom strips keep every second frame */
+	bool render_bottom = ledpattern_quality < LEDPATTERN_LOWEST_QUALITY || t % 2 == 0;
 	if (batt_empty)
 	{
 		// sets both front/side and bottom leds
+		ledpattern_bottom_saturation = 1000;
 		ledpattern_bat_empty(led_data, t, batt_cells);
 	}
 	else
@@ -195,23 +311,237 @@ void tim2_isr(void)
 		// set the front/side leds
 		//ledpattern_front_bat_and_slow_info(led_data, t, batt_cells, batt_percent, slow_warning);
 		//ledpattern_front_knightrider(led_data, t, batt_cells, batt_percent, slow_warning);
-		ledpatterns_front[ledpattern_front_idx](led_data, t, batt_cells, batt_percent, slow_warning);
+		ledpatterns_front[ledpattern_front_idx].render(led_data, t, batt_cells, batt_percent, slow_warning);
 
 		// set the bottom leds
 		//ledpattern_bottom_snake(led_data, t, pos0, velocity);
 		//ledpattern_bottom_water(led_data, t, pos0, velocity);
 		//ledpattern_bottom_rainbow(led_data, t, pos0, velocity);
-		ledpatterns_bottom[ledpattern_bottom_idx](led_data, t, pos0, velocity, brightness);
+		if (render_bottom)
+		{
+			ledpattern_bottom_saturation = 1000;
+			ledpattern_brightness = brightness;
+			ledpatterns_bottom[ledpattern_bottom_idx].render(led_data, t, pos0, velocity);
+		}
+
 		//ledpattern_bottom_position_color(led_data, t, pos0, velocity);
 	}
+	output_set_bottom(brightness * limit / 1000, ledpattern_bottom_saturation);
+
+	/* the POV pattern is repainted between the frames, unless something else
+	 * takes over the bottom leds */
+	if (!batt_empty && !sensors.braking && (ledpatterns_bottom[ledpattern_bottom_idx].inputs & LEDPATTERN_IN_REFRESH))
+	{
+		if (ws2812_refresh_hook != pov_refresh)
+		{
+			pov_refresh_cursor = (struct pov_cursor){ &pov_image_lane, 0, 0 };
+			pov_painted = INT32_MIN;
+		}
+		pov_frame(&pov_frames[!pov_frame_idx], pov_refresh_cursor.image, pos0, velocity);
+		pov_frame_start[!pov_frame_idx] = frame_start;
+		pov_frame_idx = !pov_frame_idx;
+		ws2812_refresh_hook = pov_refresh;
+	}
+	else
+	{
+		ws2812_refresh_hook = NULL;
+	}
 
+	/* the brake light overrides the bottom leds. ws2812 has already lit them
+	 * since the detection; take over from there. */
+	static int brake_t = 0;
+	if (sensors.braking)
+	{
+		ledpattern_bottom_brake(led_data, brake_t++);
+		ws2812_brake_frame_ready = true;
+	}
+	else
+	{
+		brake_t = 0;
+	}
 
+#ifdef BENCH
+	// one line per braking, which is too much for normal rides
+	static uint32_t brake_latency_us = 0;
+	if (ws2812_brake_latency_us != brake_latency_us)
+	{
+		brake_latency_us = ws2812_brake_latency_us;
+		printf("brake latency: %lu us\n", (unsigned long)brake_latency_us);
+	}
+#endif
+
+	/* park after PARK_FRAMES without a tacho edge or button press: fade out,
+	 * keep the LEDs dark for one more frame, so that a dark refresh has been
+	 * sent, then let main() stop everything */
+	static uint32_t park_edges = 0;
+	static int still_frames = 0;
+	if (park_state == PARK_RESUMED || sensors.tacho_edges != park_edges || sensors.button_pressed)
+	{
+		if (park_state == PARK_RESUMED)
+			printf("woke up\n");
+		park_state = PARK_RUNNING;
+		park_edges = sensors.tacho_edges;
+		still_frames = 0;
+	}
+	else if (still_frames <= PARK_FRAMES + PARK_FADE_FRAMES)
+	{
+		still_frames++;
+	}
+
+	if (still_frames > PARK_FRAMES)
+	{
+		fade_out(1000 * max(0, PARK_FRAMES + PARK_FADE_FRAMES - still_frames) / PARK_FADE_FRAMES);
+		if (still_frames > PARK_FRAMES + PARK_FADE_FRAMES && park_state == PARK_RUNNING)
+		{
+			printf("parking, LED idle current approx. %d mA\n", powerlimit_ma(0, LED_COUNT));
+			park_state = PARK_REQUESTED;
+		}
+	}
+
+#ifdef BENCH
+	// a DMA bank takes 40 LEDs * 24 bits * 1.3 us to send
+	static int isr_report_t = 0;
+	if (++isr_report_t == 10*FPS)
+	{
+		isr_report_t = 0;
+		printf("ws2812 isr: max %lu cycles of %d\n", (unsigned long)ws2812_isr_cycles_max, (int)(40*24*13*clock_mhz/10));
+	}
+#endif
+
+
+
+	/* pick the clock and the pattern quality for the next frames from this frame's
+	 * duration. The governor reacts first; the quality only drops if a frame comes
+	 * close to the frame period. */
+	uint32_t frame_cycles = dwt_read_cycle_counter() - frame_start;
+	clock_request = governor_update(&governor, frame_cycles);
+	int quality = framebudget_update(&framebudget, frame_cycles, animation_tick_cycles * 65536);
+	if (quality != ledpattern_quality)
+	{
+		ledpattern_quality = quality;
+		printf("quality level %d, %lu of %lu frames dropped\n", quality, (unsigned long)framebudget.dropped, (unsigned long)framebudget.frames);
+	}
+	static uint32_t reported_dropped = 0;
+	if (t % (10*FPS) == 0 && framebudget.dropped != reported_dropped)
+	{
+		reported_dropped = framebudget.dropped;
+		printf("%lu of %lu frames dropped\n", (unsigned long)framebudget.dropped, (unsigned long)framebudget.frames);
+	}
+	// the governor may switch often; every print would block on the UART
+	static uint32_t reported_switches = 0;
+	if (t % (10*FPS) == 0 && clock_switches != reported_switches)
+	{
+		printf("clock: %lu MHz, %lu switches\n", (unsigned long)clock_mhz, (unsigned long)(clock_switches - reported_switches));
+		reported_switches = clock_switches;
+	}
 
 	// must be at the end of the ISR
 	if (timer_get_flag(TIM2, TIM_SR_UIF))
 		slow_warning = 120;
 }
 
+/** Stops the renderer and the LEDs, sleeps until the wheel or the button moves,
+  * and renders the next frame right away */
+static void park(void)
+{
+	timer_disable_counter(TIM2);
+	ws2812_stop();
+	gpio_set(GPIOC, GPIO13); /* LED off */
+
+	power_stop();
+
+	park_state = PARK_RESUMED;
+	ws2812_start();
+	timer_generate_event(TIM2, TIM_EGR_UG);
+	timer_enable_counter(TIM2);
+}
+
+/** Switches the core clock between two frames */
+static void switch_clock(enum clock_mode mode)
+{
+	nvic_disable_irq(NVIC_TIM2_IRQ);
+	ws2812_stop();
+	uart_flush();
+
+	clock_set(mode);
+	uart_retime();
+	animation_tick_cycles = animation_prescaler() + 1;
+	clock_set_prescaler(TIM2, animation_prescaler());
+
+	ws2812_start();
+	nvic_enable_irq(NVIC_TIM2_IRQ);
+	clock_switches++;
+}
+
+static int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/** Handles "vm <slot> <hex>" from ../host/vmc.py: checks the program, stores it in
+  * flash and runs it from there */
+static void vm_command(const char *line)
+{
+	static uint8_t program[VM_MAX_PROGRAM];
+	int size = 0;
+
+	if (strncmp(line, "vm ", 3) != 0 || line[3] < '0' || line[3] >= '0' + VM_SLOTS || line[4] != ' ')
+	{
+		printf("unknown command\n");
+		return;
+	}
+	int slot = line[3] - '0';
+
+	for (const char *p = &line[5]; *p; p += 2)
+	{
+		int high = hex_digit(p[0]);
+		int low = high < 0 ? -1 : hex_digit(p[1]);
+		if (low < 0 || size >= VM_MAX_PROGRAM)
+		{
+			printf("vm %d: error: bad hex\n", slot);
+			return;
+		}
+		program[size++] = (high << 4) | low;
+	}
+
+	const char *error = vm_check(program, size);
+	if (error)
+	{
+		printf("vm %d: error: %s\n", slot, error);
+		return;
+	}
+
+	// erasing stalls the CPU, which the renderer and the WS2812 DMA must not notice
+	nvic_disable_irq(NVIC_TIM2_IRQ);
+	ws2812_stop();
+	bool ok = vmstore_write(slot, program, size);
+	ledpattern_vm_load(slot, vmstore_program(slot));
+	ws2812_start();
+	nvic_enable_irq(NVIC_TIM2_IRQ);
+
+	if (ok)
+		printf("vm %d: %d bytes\n", slot, size);
+	else
+		printf("vm %d: error: flash write failed\n", slot);
+}
+
+#ifdef TACHO_TRACE
+/** Handles "trace": prints the tacho trace for ../host/tacho_replay.c. The renderer,
+  * which records it, pauses meanwhile; the next frame records an overflow. */
+static void trace_command(void)
+{
+	nvic_disable_irq(NVIC_TIM2_IRQ);
+	tacho_trace_dump();
+	nvic_enable_irq(NVIC_TIM2_IRQ);
+}
+#endif
+
 int main(void)
 {
 	clock_setup();
@@ -228,15 +558,53 @@ int main(void)
 
 
 	uart_setup();
+	output_init();
 	ws2812_init();
 	tacho_init();
 	adc_init();
-	noise_init();
+	odometer_init(&odometer, WHEEL_CIRCUMFERENCE_LEDUNITS);
+	powerlimit_init(&powerlimit);
+
+	// the renderer measures its frames for the clock governor
+	dwt_enable_cycle_counter();
+	governor_init(&governor, CLOCK_N_MODES, clock_mode_mhz, clock_mode);
+	framebudget_init(&framebudget, LEDPATTERN_LOWEST_QUALITY);
+	for (int slot=0; slot<VM_SLOTS; slot++)
+		ledpattern_vm_load(slot, vmstore_program(slot));
+
+	// the patterns of this build, see 'make PATTERNS=...'
+	printf("bottom patterns:");
+	for (int p=0; p<N_BOTTOM_PATTERNS; p++)
+		printf(" %s", ledpatterns_bottom[p].name);
+	printf("\nfront patterns:");
+	for (int p=0; p<N_FRONT_PATTERNS; p++)
+		printf(" %s", ledpatterns_front[p].name);
+	printf("\n");
+
+#ifdef BENCH
+	// print the per-pattern cycle counts once, see ../host/bench_check.py
+	bench_run(dwt_read_cycle_counter, "cycles", 1);
+#endif
 
 	animation_init();
 
 	int i=0;
 	while (1) {
 		__asm__("wfe");
+		if (park_state == PARK_REQUESTED)
+			park();
+		if (clock_request != clock_mode)
+			switch_clock(clock_request);
+		const char *line = uart_line();
+		if (line)
+		{
+#ifdef TACHO_TRACE
+			if (!strcmp(line, "trace"))
+				trace_command();
+			else
+#endif
+				vm_command(line);
+			uart_line_done();
+		}
 	}
 }
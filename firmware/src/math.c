@@ -1,7 +1,7 @@
 #include "math.h"
 #include "common.h"
 
-static uint16_t sin_valuetable[1024] =
+static const uint16_t sin_valuetable[1024] =
 {
 	0, 1, 3, 4, 6, 7, 9, 10, 12, 14, 15, 17, 18, 20, 21, 23, 25, 26, 28, 29, 31,
 	32, 34, 36, 37, 39, 40, 42, 43, 45, 47, 48, 50, 51, 53, 54, 56, 58, 59, 61, 62,
@@ -1,24 +1,116 @@
-#include <stdlib.h>
-#include <stdio.h>
 #include "common.h"
+#include "noise.h"
 
 #define RESOLUTION_X 16
 #define RESOLUTION_Y 64
 
-static fixed_t random_data[RESOLUTION_X][RESOLUTION_Y]; // between -(1<<SHIFT) and (1<<SHIFT)
+/* Value noise lattice, between -(1<<SHIFT) and (1<<SHIFT), stored in half resolution to save flash.
+ * These are the values the firmware used to generate at boot with newlib's rand():
+ * random_data[i][j] = (rand() % (2*ONE) - ONE) >> 1, for i, j in row-major order. Being const,
+ * the table lives in flash instead of taking 8 KB of RAM. */
+static const int16_t random_data[RESOLUTION_X][RESOLUTION_Y] =
+{
+	{
+		31254, 18023, 31523, 6292, -21118, 11994, 16316, 11500, 9268, 11091, 23551, 27167, 21141, -8840, 8446, 14316,
+		6077, 971, 12036, 14358, 5714, -24405, -4166, -32334, 7778, -20521, 22666, 17172, 24530, 10356, -29909, -26643,
+		12591, 10256, 10877, 24604, -5420, 39, 17363, -7286, 18121, 27538, -13781, -15598, 29474, -26257, 684, 16070,
+		30369, 19389, 24031, -23096, 19339, 19140, 11342, 28735, -8773, 2915, -30313, -17517, 4428, -31932, 18170, 15578
+	},
+	{
+		7448, 18154, -9062, -23474, 3613, 13318, -5369, -3234, 279, 30416, -26629, 4231, 18540, 18612, -3718, 364,
+		25758, 5588, -22374, 882, 15047, 32533, -21274, -13727, 12832, -30752, 19815, 5673, 12472, 32565, -17095, 7572,
+		17, -12584, 11565, 21133, -10031, 17301, 16193, -13756, -21086, 26124, 5511, -21736, 14585, 10933, 13649, 27735,
+		6151, -15038, -16666, -16476, 23403, -3775, -29023, 9739, -13, -28719, 16412, 1609, 16441, -10781, -22669, 3960
+	},
+	{
+		581, -11137, -10736, 4621, 24716, -14913, -910, 13754, -25017, 32355, -13629, 4162, -8660, 10862, -26606, -28557,
+		10062, -20690, 6434, 12320, -11451, 18477, -1775, -8913, -20780, -20745, 26998, -225, -25656, -29490, 21949, 21792,
+		-4213, -4724, -21319, 22389, -7421, 15865, -20536, 12919, -30372, -17098, 29535, -13076, 15770, 7931, -22246, 30609,
+		-3709, 30397, -24935, 3896, -24245, 27755, -3543, -7415, -9862, 6719, -18071, -54, -24246, 28083, -253, -3951
+	},
+	{
+		-1364, -16263, -24265, -17411, 30579, 23158, -4012, -18573, -21419, -13355, -21476, 7007, 4061, -5201, -13742, -7080,
+		-5033, 16530, -21184, -25424, 1477, 9788, -21598, 29938, 4894, 32547, -27076, -3300, 17955, 15971, 15054, -16148,
+		-14811, 19415, 32432, -10229, 23965, 25054, 28981, 15482, 25576, 6818, 4525, -2872, -11034, 16303, -14662, -16977,
+		-26720, 32220, 17130, 8732, -6141, -13569, 2540, 26285, -32168, -9577, 15395, 25310, -9657, 30746, 25749, 11164
+	},
+	{
+		29286, -23275, 11607, 24919, -21967, -28537, -21181, -17350, -1622, -7238, -28402, 22072, 30161, -19196, -19855, -6737,
+		-10657, 3801, 2058, -25923, -1645, -17876, 9363, -13771, 4488, 5996, -20904, 16008, -18227, 15959, -22398, 4356,
+		29084, -4414, 13803, 19589, 4291, 9514, -5059, -3631, 26426, -10982, -22177, 31007, 13368, 3894, -11198, 15379,
+		27963, 31968, -1048, 16097, 22256, 27083, -32718, -19696, -2894, 13366, -1606, 30083, -23035, 21806, 31171, -13136
+	},
+	{
+		-7953, 18011, 18094, -19899, -29886, -8933, 24944, -28195, -12577, 8779, 24386, -16559, -22779, 22880, 22701, -29660,
+		26254, 3044, -32158, -19772, 26036, -15767, -15915, -10983, 17639, -20296, -30492, 9451, -25846, -10456, 12881, 259,
+		10054, 27022, 31206, 14326, -24860, -24579, 9188, 16140, 27051, -17022, -24141, 4734, -31548, -23606, -29067, 9769,
+		7134, 25471, -27870, -26386, -20398, -30064, -25622, -16687, 28966, 711, 18890, 6345, -16688, 27282, -25542, -4506
+	},
+	{
+		-26227, -11518, 7633, -17473, -352, 6911, -16375, -1497, -21727, 30796, -8091, 30521, -1157, 8444, 27818, -7079,
+		-23318, -28810, -13734, 18447, 32577, -24129, -19285, 28465, 17597, -11600, 25811, 24789, 19647, -18858, 9328, 5624,
+		-7054, 3740, -16858, 1075, 19229, 2959, 8923, -12888, 23125, -13389, -27748, -27792, 22007, 25179, 8755, 23366,
+		27683, 6081, 6915, 25697, -4174, -13599, 17926, 1781, 17200, -16604, 17783, -18253, 10433, -10667, 30483, -6215
+	},
+	{
+		-1106, 1354, 12044, 13163, -20444, -1649, -24936, 29888, 24720, 2022, 30086, -6036, -20829, 29752, 28376, -2611,
+		-22343, -4075, -7534, 7304, 18374, -14784, 14093, 21866, 6550, 26778, -19371, -31820, -7978, -28869, 17721, 15424,
+		20163, 69, 22933, -16979, 8087, 8467, -14113, -16913, 3446, -21665, 11548, -32682, 28632, -26257, -31279, -17274,
+		32276, -284, 7735, -13841, 18492, 31491, 28380, 194, -6779, -31687, -15663, 7189, -9178, 471, -3013, 23011
+	},
+	{
+		837, 9183, -30274, -23680, -5662, 19343, -3485, 26892, -28510, -24180, 10870, -12497, 25011, 26232, 14798, -30539,
+		-32544, -1044, -32360, -19290, 15271, -4067, 8456, 2528, 4459, -18883, 18480, 13756, 30614, -25103, -2430, 17771,
+		-2922, 8642, -540, -20651, 29676, 22678, -2026, 16600, 26832, 10481, 29866, -30895, 1382, -1021, 12928, 25265,
+		24969, 26167, 12040, -17724, -31966, -11061, -11385, 27558, -31113, -3103, -20430, 5241, -12326, 5283, -29233, 7744
+	},
+	{
+		14638, -7493, 30657, 30369, -13683, 13836, 11727, 12300, -30596, 8406, 10535, 8561, -499, 8456, -5206, -13345,
+		31812, 20905, -11961, -25788, 24702, 22664, -8675, -27193, -3075, 11457, -9431, 21955, -1783, 2607, -18683, 17945,
+		-4770, -6141, -28950, -8580, -11393, 2016, 8824, 4583, -4088, 32362, 27790, -10214, 18173, -921, 15783, -19434,
+		3723, -13312, -10564, -23453, -16901, 4738, 9030, -31980, -5036, -1082, -12387, 3577, 25517, 18261, -135, 5163
+	},
+	{
+		909, 9218, -31549, -7230, -9260, 16191, -583, -449, 32090, -22168, -29424, -10578, -2150, 11768, 12149, -9580,
+		-11736, -26272, -29140, -31357, -19593, -18281, -15710, 11081, -26819, 8076, -675, -1759, 12123, 10794, 954, -11302,
+		-9723, 2712, 23043, 26288, 17380, 24912, 14117, -12019, -20218, -32700, 5701, 23525, 21677, 1828, -11707, 23148,
+		-16975, 2135, -6918, 1157, -30428, 26051, -31523, 4193, -17981, 31300, -11742, 32548, 10944, 5747, 22488, -12573
+	},
+	{
+		22060, -26396, -6744, -17915, 2244, 15720, 26335, -21120, 10475, -15413, -26999, -28724, -4305, -23810, -6529, 8820,
+		-21872, -25241, -31010, 22188, -2121, 12321, -16096, -22686, -11357, 22820, 24484, 19346, 16696, -23178, -26311, 8977,
+		17743, 5259, -21131, -19040, -5319, 21186, -4149, 15496, -28585, -21936, -10790, -12990, -28508, -25129, 2642, 6325,
+		-24445, 22025, 7974, -8966, 26144, -12711, 31732, 23723, 4648, -15547, -11463, 14555, 5603, 21845, 27097, 9062
+	},
+	{
+		-15651, 17023, 16363, 3228, -3032, 9652, 17206, 26343, -14930, 23120, 15917, 7931, -19224, 11351, 12735, -22183,
+		-31073, 17207, 31591, 1040, -6985, 3231, 32693, -3131, -10091, -28656, 32495, 20245, -29648, 30692, 5405, 1231,
+		25651, -10941, -12343, -22793, 5773, 17513, 32260, 19137, -2678, 3224, 13645, -20485, 20871, 21011, 10272, -32486,
+		-1578, 15220, 20418, 1931, -23051, -11998, 11895, 689, -25086, 1315, 13350, -27086, -518, 8446, -25062, -27055
+	},
+	{
+		-5671, -11591, -12034, -16729, -20759, -17641, 8022, 11432, 27483, -27152, 10296, -4201, -21877, -2138, -9417, 13108,
+		2295, 25680, 23707, 22757, -19292, 28683, -12939, 18617, -7996, -17481, -20564, 31690, -8430, -11167, -2208, -15175,
+		13892, -20127, 22319, -32703, -24519, -18508, -26440, 9264, -10352, 6206, 2034, 10484, -2860, -24509, 12215, -30002,
+		-27087, 21359, -18991, 27092, -22638, 3822, 2551, -24390, -4276, -29303, -10409, -29616, -29095, -19712, 9287, -22073
+	},
+	{
+		18976, -4825, -2647, -4332, -12694, 7473, 30669, 17399, -13512, -25810, -2071, 19974, -31256, 32466, 8016, 18417,
+		7705, -30957, -5249, -26072, 4803, -10300, 30661, 20217, 18061, 18751, -30431, 16343, 5198, -6181, 954, -6430,
+		1546, -11356, -7969, -13111, -18874, -14804, -5767, -711, 10529, 19546, -4660, -18929, 20806, -21884, -8136, 2029,
+		-23512, -2528, -11214, 2348, 30247, -17569, -14070, 27247, 17883, -4527, -17469, -26034, -28891, 5210, -31615, 2886
+	},
+	{
+		29147, 18409, 4456, 17537, -7441, 14123, 22154, 32480, 19585, 9970, 739, -28773, 29497, 13034, -10694, 6483,
+		-31547, 30629, -18266, 2687, 27083, -31898, 32706, 8600, -1963, 12398, -20273, 24386, 3159, 31773, 776, -14928,
+		18788, 15813, 10358, 6519, 201, -32686, -9754, -12274, -23275, -15650, 14065, -14843, -30420, -11379, 3389, -1189,
+		-4927, -15901, -24318, -387, -14451, -3128, -10073, -25919, -19519, 613, -1972, -26343, -28746, -20390, -28492, -24175
+	}
+};
 
 #define MUL(a,b) ((a*b)>>SHIFT)
 #define NUM(x) ((x)<<SHIFT)
 
-void noise_init(void)
-{
-	for (int i=0; i<RESOLUTION_X; i++)
-		for (int j=0; j<RESOLUTION_Y; j++)
-			random_data[i][j] = rand() % (2*ONE) - ONE ;
-
-	printf("noise: RAND_MAX = %d, val = %d\n", RAND_MAX, random_data[4][4]);
-}
-
 fixed_t noise(fixed_t x, fixed_t y)
 {
 	const fixed_t wrap_x = RESOLUTION_X << SHIFT;
@@ -32,10 +124,10 @@ fixed_t noise(fixed_t x, fixed_t y)
 	fixed_t x_frac = x % (1<<SHIFT);
 	fixed_t y_frac = y % (1<<SHIFT);
 
-	fixed_t r11 = random_data[x_int][y_int];
-	fixed_t r12 = random_data[x_int][(y_int+1)%RESOLUTION_Y];
-	fixed_t r21 = random_data[(x_int+1)%RESOLUTION_X][y_int];
-	fixed_t r22 = random_data[(x_int+1)%RESOLUTION_X][(y_int+1)%RESOLUTION_Y];
+	fixed_t r11 = random_data[x_int][y_int] * 2;
+	fixed_t r12 = random_data[x_int][(y_int+1)%RESOLUTION_Y] * 2;
+	fixed_t r21 = random_data[(x_int+1)%RESOLUTION_X][y_int] * 2;
+	fixed_t r22 = random_data[(x_int+1)%RESOLUTION_X][(y_int+1)%RESOLUTION_Y] * 2;
 
 	fixed_t val1 = r11 + (((r12-r11)*y_frac)>>SHIFT);
 	fixed_t val2 = r21 + (((r22-r21)*y_frac)>>SHIFT);
@@ -50,3 +142,124 @@ fixed_t fractal_noise(fixed_t x, fixed_t y, fixed_t amp1, fixed_t amp2, fixed_t
 		MUL(amp2, noise(x*2 + NUM(3187), y*2 + NUM(1379))) +
 		MUL(amp2, noise(x*4 + NUM(827), y*4 + NUM(2913)));
 }
+
+
+/* Gradient noise
+ *
+ * Lattice gradients are derived from an integer hash of the cell coordinates, so
+ * no table is needed. Everything is 32 bit; internally, the fractional part uses
+ * GRAD_SHIFT bits so that the interpolation cannot overflow. Coordinates wrap
+ * around seamlessly every 65536 units. */
+
+#define GRAD_SHIFT 12
+#define GRAD_ONE (1 << GRAD_SHIFT)
+
+static uint32_t hash2(uint32_t xi, uint32_t yi)
+{
+	uint32_t h = (xi & 0xFFFF) * 0x8da6b343u ^ (yi & 0xFFFF) * 0xd8163841u;
+	h ^= h >> 15;
+	h *= 0x2c1b3c6du;
+	h ^= h >> 12;
+	return h;
+}
+
+/* the 8 gradient directions, selected by the hash. A multiply is cheaper than a
+ * switch here, which mispredicts on every other call. */
+static const int8_t GRAD_X[8] = { 1, -1, 1, -1, 1, -1, 0, 0 };
+static const int8_t GRAD_Y[8] = { 1, 1, -1, -1, 0, 0, 1, -1 };
+
+/** dot product of the hashed gradient with (dx, dy) */
+static int32_t grad(uint32_t h, int32_t dx, int32_t dy)
+{
+	h = (h >> 13) & 7;
+	return GRAD_X[h] * dx + GRAD_Y[h] * dy;
+}
+
+/** smoothstep 3t² - 2t³ */
+static int32_t fade(int32_t t)
+{
+	return (((t * t) >> GRAD_SHIFT) * (3 * GRAD_ONE - 2 * t)) >> GRAD_SHIFT;
+}
+
+static int32_t lerp(int32_t a, int32_t b, int32_t f)
+{
+	return a + (((b - a) * f) >> GRAD_SHIFT);
+}
+
+/* Converts from GRAD_SHIFT to SHIFT fractional bits. The interpolated dot products
+ * reach at most +-GRAD_ONE (all four gradients pointing at the centre of the cell),
+ * so this maps one octave exactly onto -ONE..ONE. */
+#define GNOISE_GAIN (ONE / GRAD_ONE)
+#define GNOISE_SCALE(v) ((v) * GNOISE_GAIN)
+
+int32_t gnoise(uint32_t x, uint32_t y)
+{
+	uint32_t xi = x >> SHIFT, yi = y >> SHIFT;
+	int32_t dx = (x & (ONE-1)) >> (SHIFT - GRAD_SHIFT);
+	int32_t dy = (y & (ONE-1)) >> (SHIFT - GRAD_SHIFT);
+
+	int32_t n00 = grad(hash2(xi, yi), dx, dy);
+	int32_t n10 = grad(hash2(xi+1, yi), dx - GRAD_ONE, dy);
+	int32_t n01 = grad(hash2(xi, yi+1), dx, dy - GRAD_ONE);
+	int32_t n11 = grad(hash2(xi+1, yi+1), dx - GRAD_ONE, dy - GRAD_ONE);
+
+	int32_t fx = fade(dx), fy = fade(dy);
+	int32_t result = lerp(lerp(n00, n10, fx), lerp(n01, n11, fx), fy);
+	return GNOISE_SCALE(result);
+}
+
+/* per-octave offsets, so that the octaves are not correlated at the origin */
+static const uint32_t OCTAVE_OFFSET_X[GNOISE_MAX_OCTAVES] = { 0, 3187u << SHIFT, 827u << SHIFT, 5791u << SHIFT };
+static const uint32_t OCTAVE_OFFSET_Y[GNOISE_MAX_OCTAVES] = { 0, 1379u << SHIFT, 2913u << SHIFT, 4421u << SHIFT };
+
+int32_t gnoise_fractal(uint32_t x, uint32_t y, int octaves)
+{
+	int32_t result = 0;
+	for (int o=0; o<octaves; o++)
+		result += gnoise((x << o) + OCTAVE_OFFSET_X[o], (y << o) + OCTAVE_OFFSET_Y[o]) >> (o+1);
+	return result;
+}
+
+void gnoise_row(int32_t out[], int n, uint32_t x0, uint32_t dx, uint32_t y, int octaves)
+{
+	for (int i=0; i<n; i++)
+		out[i] = 0;
+
+	for (int o=0; o<octaves; o++)
+	{
+		/* everything depending on y only is the same for the whole row */
+		uint32_t y_o = (y << o) + OCTAVE_OFFSET_Y[o];
+		uint32_t yi = y_o >> SHIFT;
+		int32_t fy_frac = (y_o & (ONE-1)) >> (SHIFT - GRAD_SHIFT);
+		int32_t fy = fade(fy_frac);
+
+		uint32_t x = (x0 << o) + OCTAVE_OFFSET_X[o];
+		uint32_t step = dx << o;
+
+		/* the corner hashes only change when the row crosses into the next cell */
+		uint32_t xi = (x >> SHIFT) + 1; // forces a recalculation for the first LED
+		uint32_t h00 = 0, h10 = 0, h01 = 0, h11 = 0;
+
+		for (int i=0; i<n; i++, x += step)
+		{
+			if ((x >> SHIFT) != xi)
+			{
+				xi = x >> SHIFT;
+				h00 = hash2(xi, yi);
+				h10 = hash2(xi+1, yi);
+				h01 = hash2(xi, yi+1);
+				h11 = hash2(xi+1, yi+1);
+			}
+
+			int32_t fx_frac = (x & (ONE-1)) >> (SHIFT - GRAD_SHIFT);
+			int32_t fx = fade(fx_frac);
+			int32_t n00 = grad(h00, fx_frac, fy_frac);
+			int32_t n10 = grad(h10, fx_frac - GRAD_ONE, fy_frac);
+			int32_t n01 = grad(h01, fx_frac, fy_frac - GRAD_ONE);
+			int32_t n11 = grad(h11, fx_frac - GRAD_ONE, fy_frac - GRAD_ONE);
+
+			int32_t value = lerp(lerp(n00, n10, fx), lerp(n01, n11, fx), fy);
+			out[i] += GNOISE_SCALE(value) >> (o+1);
+		}
+	}
+}
@@ -1,7 +1,34 @@
 #pragma once
 
+#include <stdint.h>
 #include "common.h"
 
-void noise_init(void);
+/* Noise module
+ *
+ * Resources: none
+ *
+ * Two engines:
+ *   - noise()/fractal_noise(): value noise on a 16x64 lattice, stored in flash. Repeats
+ *     every 16 units in x and every 64 units in y.
+ *   - gnoise*(): table-free gradient noise on a hashed lattice, 32 bit fixed point.
+ *     Repeats only every 65536 units. gnoise_row() evaluates a whole row of LEDs at once.
+ *
+ * All values use SHIFT fractional bits. The value noise is roughly within -ONE..ONE,
+ * gnoise() is strictly within -ONE..ONE and the sums of octaves stay below that.
+ */
+
 fixed_t noise(fixed_t x, fixed_t y);
 fixed_t fractal_noise(fixed_t x, fixed_t y, fixed_t amp1, fixed_t amp2, fixed_t amp3);
+
+#define GNOISE_MAX_OCTAVES 4
+
+/** Gradient noise at (x, y). x is usually the position along the strip, y the time */
+int32_t gnoise(uint32_t x, uint32_t y);
+
+/** Sum of `octaves` (1..GNOISE_MAX_OCTAVES) octaves of gnoise() with the amplitudes
+  * 1/2, 1/4, 1/8, ... and the frequencies 1, 2, 4, ... */
+int32_t gnoise_fractal(uint32_t x, uint32_t y, int octaves);
+
+/** Evaluates gnoise_fractal(x0 + i*dx, y, octaves) for i=0..n-1 into out[]. This is much
+  * cheaper than n single calls, because the row shares y and the lattice cells. */
+void gnoise_row(int32_t out[], int n, uint32_t x0, uint32_t dx, uint32_t y, int octaves);
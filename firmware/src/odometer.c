@@ -0,0 +1,27 @@
+#include "odometer.h"
+
+void odometer_init(struct odometer *odo, fixed_t circumference)
+{
+	odo->revolutions = 0;
+	odo->phase = 0;
+	odo->circumference = circumference;
+	// the only division, done once
+	odo->phase_scale = (circumference << 16) / ODOMETER_PHASE_PER_REV;
+}
+
+void odometer_advance(struct odometer *odo, uint32_t frequency_millihertz)
+{
+	odo->phase += frequency_millihertz;
+	while (odo->phase >= ODOMETER_PHASE_PER_REV)
+	{
+		odo->phase -= ODOMETER_PHASE_PER_REV;
+		odo->revolutions++;
+	}
+}
+
+fixed_t odometer_position(const struct odometer *odo)
+{
+	// phase < 2^16 and phase_scale < 2^32: a single 32x32->64 bit multiply
+	fixed_t partial = ((uint64_t)odo->phase * odo->phase_scale) >> 16;
+	return odo->revolutions * odo->circumference + partial;
+}
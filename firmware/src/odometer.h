@@ -0,0 +1,38 @@
+#pragma once
+#include <stdint.h>
+#include "common.h"
+
+/* Odometer module: the wheel position, exact over arbitrarily long rides.
+ *
+ * Resources: none
+ *
+ * The position is kept as whole wheel revolutions plus the phase within the
+ * current revolution. The phase advances by frequency_millihertz each frame,
+ * so ODOMETER_PHASE_PER_REV phase units are one revolution. Unlike a single
+ * int accumulator, this never overflows (2^32 revolutions are 2.6 million km)
+ * and the position needs no division per frame.
+ *
+ * Usage:
+ *   - call odometer_init(&odo, circumference) once
+ *   - call odometer_advance(&odo, frequency_millihertz) once per frame
+ *   - odometer_position(&odo) is the distance in ledunits
+ */
+
+#define ODOMETER_PHASE_PER_REV (FPS * FREQUENCY_FACTOR)
+
+struct odometer
+{
+	uint32_t revolutions;
+	uint32_t phase; // 0 .. ODOMETER_PHASE_PER_REV-1
+	fixed_t circumference; // ledunits per revolution
+	uint32_t phase_scale; // ledunits per phase unit, with 16 fractional bits
+};
+
+/** circumference: the wheel circumference in ledunits */
+void odometer_init(struct odometer *odo, fixed_t circumference);
+
+/** Advances the position by one frame at the given wheel frequency */
+void odometer_advance(struct odometer *odo, uint32_t frequency_millihertz);
+
+/** The distance travelled since odometer_init(), in ledunits */
+fixed_t odometer_position(const struct odometer *odo);
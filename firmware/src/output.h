@@ -0,0 +1,87 @@
+#pragma once
+#include <stdint.h>
+#include "common.h"
+
+/* Output stage module. Maps the colours in led_data to the values sent to the LEDs.
+ *
+ * Resources: none
+ *
+ * Patterns write colour without gamma correction, global brightness or white
+ * balance. Each channel is mapped through a 256 entry table which combines all
+ * three, so that every LED costs three table lookups. The WS2812 encoder does
+ * this while sending.
+ *
+ * The tables hold 8.8 fixed point values. The LEDs take 8 bits, but the chain
+ * is sent about four times per rendered frame, so the encoder dithers: each LED
+ * channel keeps the fractional part that was not sent, and adds it to the next
+ * refresh. Dim colours and low brightness, where the 8 bit gamma curve only
+ * has a few steps, average out to the exact value.
+ *
+ * The bottom strips use a table that includes the global brightness and the
+ * saturation requested by the bottom pattern (see ledpattern_bottom_saturation).
+ * It is double buffered, because the encoder may be reading it while it is
+ * rebuilt. All other LEDs use a table without either.
+ *
+ * Usage:
+ *   - call output_init();
+ *   - call output_set_bottom() once per frame, after rendering
+ *   - output_map_led() maps one LED's colour, rounded to 8 bits
+ *   - output_dither() maps one LED's colour for sending
+ */
+
+struct output_lut
+{
+	uint16_t g[256];
+	uint16_t r[256];
+	uint16_t b[256];
+};
+
+extern struct output_lut output_lut_front;
+extern const struct output_lut * volatile output_lut_bottom;
+
+void output_init(void);
+
+/** Sets the bottom strips' brightness and saturation (0..1000). A lower saturation
+  * moves every channel towards white. Rebuilds the table if either changed. */
+void output_set_bottom(int brightness, int saturation);
+
+/** Returns the table for the LED with the given index in led_data */
+static inline const struct output_lut *output_lut_led(int index)
+{
+	if (index >= N_SIDE+N_FRONT+N_SIDE && index < N_SIDE+N_FRONT+N_SIDE+2*N_BOTTOM)
+		return output_lut_bottom;
+	else
+		return &output_lut_front;
+}
+
+/** Maps one 0x00GGRRBB colour through a table, rounded to 8 bits per channel */
+static inline uint32_t output_map(const struct output_lut *lut, uint32_t color)
+{
+	return ((uint32_t)((lut->g[(color >> 16) & 0xFF] + 0x80) >> 8) << 16) |
+		((uint32_t)((lut->r[(color >> 8) & 0xFF] + 0x80) >> 8) << 8) |
+		((lut->b[color & 0xFF] + 0x80) >> 8);
+}
+
+/** Maps the colour of the LED with the given index in led_data */
+static inline uint32_t output_map_led(int index, uint32_t color)
+{
+	return output_map(output_lut_led(index), color);
+}
+
+/** Adds the remainder of the last refresh to value (8.8) and keeps the new remainder */
+static inline uint32_t output_dither_channel(uint16_t value, uint8_t *remainder)
+{
+	// the tables end at 255.0, so this cannot exceed 255
+	uint32_t sum = value + *remainder;
+	*remainder = sum & 0xFF;
+	return sum >> 8;
+}
+
+/** Maps one 0x00GGRRBB colour through a table for sending. remainder holds
+  * the LED's g, r and b remainders from the last refresh. */
+static inline uint32_t output_dither(const struct output_lut *lut, uint32_t color, uint8_t remainder[3])
+{
+	return (output_dither_channel(lut->g[(color >> 16) & 0xFF], &remainder[0]) << 16) |
+		(output_dither_channel(lut->r[(color >> 8) & 0xFF], &remainder[1]) << 8) |
+		output_dither_channel(lut->b[color & 0xFF], &remainder[2]);
+}
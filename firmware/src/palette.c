@@ -0,0 +1,48 @@
+#include "palette.h"
+
+#define N_STOPS(stops) ((int)(sizeof(stops) / sizeof(*stops)))
+
+static const struct palette_stop lava_stops[] = {
+	{ 0, 0x4fec00 }, { 64, 0x72e400 }, { 128, 0x93dc00 }, { 191, 0xb2d500 }, { 255, 0xcfcf00 }
+};
+const struct palette palette_lava = { lava_stops, N_STOPS(lava_stops) };
+
+static const struct palette_stop water_stops[] = {
+	{ 0, 0xe40072 }, { 21, 0xdc0093 }, { 43, 0xd500b2 }, { 64, 0xcf00cf }, { 85, 0xb200d5 },
+	{ 106, 0x9300dc }, { 128, 0x7200e4 }, { 149, 0x4f00ec }, { 170, 0x2800f5 }, { 191, 0x0000ff },
+	{ 213, 0x0028f5 }, { 234, 0x004fec }, { 255, 0x0072e4 }
+};
+const struct palette palette_water = { water_stops, N_STOPS(water_stops) };
+
+static const struct palette_stop rainbow_stops[] = {
+	{ 0, 0x00ff00 }, { 21, 0x72e400 }, { 43, 0xcfcf00 }, { 64, 0xe47200 }, { 85, 0xff0000 },
+	{ 106, 0xe40072 }, { 128, 0xcf00cf }, { 149, 0x7200e4 }, { 170, 0x0000ff }, { 191, 0x0072e4 },
+	{ 213, 0x00cfcf }, { 234, 0x00e472 }, { 255, 0x00ff00 }
+};
+const struct palette palette_rainbow = { rainbow_stops, N_STOPS(rainbow_stops) };
+
+/* the table of the palette used last */
+static uint32_t shared_lut[256];
+static const struct palette *shared_palette = 0;
+
+void palette_build(uint32_t lut[256], const struct palette *palette)
+{
+	const struct palette_stop *stops = palette->stops;
+	for (int s=0; s+1<palette->n_stops; s++)
+	{
+		int width = stops[s+1].index - stops[s].index;
+		for (int i=stops[s].index; i<stops[s+1].index; i++)
+			lut[i] = lerp_grb(stops[s].color, stops[s+1].color, (i - stops[s].index) * 256 / width);
+	}
+	lut[255] = stops[palette->n_stops-1].color;
+}
+
+const uint32_t *palette_use(const struct palette *palette)
+{
+	if (palette != shared_palette)
+	{
+		palette_build(shared_lut, palette);
+		shared_palette = palette;
+	}
+	return shared_lut;
+}
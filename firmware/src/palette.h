@@ -0,0 +1,76 @@
+#pragma once
+#include <stdint.h>
+#include "color.h"
+
+/* Palette module: colour gradients as lookup tables.
+ *
+ * Resources: none
+ *
+ * A palette is a list of gradient stops (index 0..255, colour), the first at
+ * index 0 and the last at 255. palette_use() expands it into a table of 256
+ * colours by linear interpolation, on the first use after another palette was
+ * used, i.e. once per pattern switch. Patterns then look colours up by an 8 bit
+ * index, or by an 8.8 index which interpolates between two entries, instead of
+ * computing them with hsv2() per LED. A colour theme is just another list of
+ * stops.
+ *
+ * Saturation and value can be applied to a colour afterwards with
+ * palette_desaturate() and palette_scale(). The palettes below are sampled
+ * from hsv2() with full saturation and value every 100 or 300 hue units.
+ *
+ * Usage:
+ *   - const uint32_t *lut = palette_use(&palette_lava); once per frame
+ *   - palette_color(lut, index) or palette_lerp(lut, index << 8 | frac) per LED
+ */
+
+struct palette_stop
+{
+	uint8_t index;
+	uint32_t color; // 0x00GGRRBB
+};
+
+struct palette
+{
+	const struct palette_stop *stops;
+	int n_stops;
+};
+
+extern const struct palette palette_lava;    // hue 200..600
+extern const struct palette palette_water;   // hue 1500..2700
+extern const struct palette palette_rainbow; // hue 0..3600
+
+/** Expands the stops into lut */
+void palette_build(uint32_t lut[256], const struct palette *palette);
+
+/** Returns the table of the palette, building it into the shared table if
+  * another palette was used last */
+const uint32_t *palette_use(const struct palette *palette);
+
+static inline uint32_t palette_color(const uint32_t lut[256], uint8_t index)
+{
+	return lut[index];
+}
+
+/** index: 8.8 fixed point, 0..0xFF00 */
+static inline uint32_t palette_lerp(const uint32_t lut[256], uint16_t index)
+{
+	int i = index >> 8;
+	int frac = index & 0xFF;
+	return frac ? lerp_grb(lut[i], lut[i+1], frac) : lut[i];
+}
+
+/** Blends the colour with the grey of its brightest channel, saturation in 0..256.
+  * This is what lowering the saturation in hsv2() does. */
+static inline uint32_t palette_desaturate(uint32_t color, int saturation)
+{
+	uint32_t g = color >> 16, r = (color >> 8) & 0xFF, b = color & 0xFF;
+	uint32_t m = g > r ? g : r;
+	m = m > b ? m : b;
+	return lerp_grb(m * 0x010101, color, saturation);
+}
+
+/** Scales the colour by value/256 */
+static inline uint32_t palette_scale(uint32_t color, int value)
+{
+	return lerp_grb(0, color, value);
+}
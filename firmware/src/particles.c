@@ -0,0 +1,95 @@
+#include "particles.h"
+
+#if PARTICLES_MAX >= PARTICLES_NONE
+#error "PARTICLES_MAX does not fit the 8 bit free list"
+#endif
+
+void particles_init(struct particles *ps, uint32_t seed)
+{
+	for (int k=0; k<PARTICLES_MAX; k++)
+	{
+		ps->life[k] = 0;
+		ps->next_free[k] = k+1 < PARTICLES_MAX ? k+1 : PARTICLES_NONE;
+	}
+	ps->free = 0;
+	ps->count = 0;
+	ps->random = seed ? seed : 1;
+}
+
+bool particles_emit(struct particles *ps, int32_t pos, int32_t velocity, uint32_t color, int lifetime)
+{
+	int k = ps->free;
+	if (k == PARTICLES_NONE)
+		return false;
+	ps->free = ps->next_free[k];
+
+	ps->pos[k] = pos;
+	ps->velocity[k] = velocity;
+	ps->color[k] = color;
+	ps->life[k] = lifetime;
+	ps->lifetime[k] = lifetime;
+	ps->count++;
+	return true;
+}
+
+void particles_update(struct particles *ps)
+{
+	for (int k=0; k<PARTICLES_MAX; k++)
+	{
+		if (ps->life[k] == 0)
+			continue;
+
+		ps->pos[k] += ps->velocity[k];
+		ps->life[k]--;
+		if (ps->life[k] == 0 || ps->pos[k] < -ONE || ps->pos[k] >= N_BOTTOM * ONE)
+		{
+			ps->life[k] = 0;
+			ps->next_free[k] = ps->free;
+			ps->free = k;
+			ps->count--;
+		}
+	}
+}
+
+/** Adds color, scaled by weight/65536, to one LED of both strips */
+static void splat(volatile uint32_t led_data[], int i, uint32_t color, uint32_t weight)
+{
+	if (i < 0 || i >= N_BOTTOM)
+		return;
+
+	volatile uint32_t *led = &led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM-1-i];
+	uint32_t c = *led;
+	uint32_t g = ((c >> 16) & 0xFF) + ((((color >> 16) & 0xFF) * weight) >> 16);
+	uint32_t r = ((c >> 8) & 0xFF) + ((((color >> 8) & 0xFF) * weight) >> 16);
+	uint32_t b = (c & 0xFF) + (((color & 0xFF) * weight) >> 16);
+	c = ((g > 0xFF ? 0xFF : g) << 16) | ((r > 0xFF ? 0xFF : r) << 8) | (b > 0xFF ? 0xFF : b);
+
+	*led = c;
+	led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM+i] = c;
+}
+
+void particles_render(const struct particles *ps, volatile uint32_t led_data[])
+{
+	for (int k=0; k<PARTICLES_MAX; k++)
+	{
+		if (ps->life[k] == 0)
+			continue;
+
+		// fade linearly over the lifetime, split between the two nearest LEDs
+		uint32_t fade = (ps->life[k] << 8) / ps->lifetime[k];
+		int i = ps->pos[k] >> SHIFT;
+		uint32_t frac = (ps->pos[k] & (ONE - 1)) >> (SHIFT - 8);
+		splat(led_data, i, ps->color[k], fade * (256 - frac));
+		splat(led_data, i + 1, ps->color[k], fade * frac);
+	}
+}
+
+uint32_t particles_random(struct particles *ps)
+{
+	uint32_t x = ps->random;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	ps->random = x;
+	return x;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "common.h"
+
+/* Particle module: short-lived dots moving along the bottom strips.
+ *
+ * Resources: none
+ *
+ * Particles live in a pool of PARTICLES_MAX slots, stored as one array per
+ * attribute. Free slots are chained in a free list, so emitting takes
+ * constant time and nothing is allocated at runtime. Positions and
+ * velocities are 16.16 fixed point in 32 bits, in LED units (per frame)
+ * along a bottom strip, 0 being the rear end. A particle fades out over
+ * its lifetime and is splatted additively onto the two LEDs next to it;
+ * both strips show the same.
+ *
+ * The pool size is derived from the frame budget: the particles may use
+ * PARTICLES_BUDGET_CYCLES per frame, and one particle costs PARTICLES_CYCLES.
+ * The "particles" kernel of the benchmark (see bench.c) measures a full pool
+ * and prints the cost per particle.
+ *
+ * Usage:
+ *   - particles_init(&ps, seed) once
+ *   - particles_emit() new particles, particles_update() once per frame, then
+ *     particles_render() onto the background
+ */
+
+/** Cost of one particle per frame, update and render, in cycles. An estimate
+  * (~80 instructions at 2 flash wait states); check it with 'make BENCH=1'. */
+#define PARTICLES_CYCLES 250
+/** The particles may take 2% of a frame at 72 MHz */
+#define PARTICLES_BUDGET_CYCLES (72000000 / FPS / 50)
+#define PARTICLES_MAX (PARTICLES_BUDGET_CYCLES / PARTICLES_CYCLES)
+#define PARTICLES_NONE 0xFF
+
+struct particles
+{
+	int32_t pos[PARTICLES_MAX];
+	int32_t velocity[PARTICLES_MAX];
+	uint32_t color[PARTICLES_MAX];   // 0x00GGRRBB at the start of its life
+	uint8_t life[PARTICLES_MAX];     // frames left, 0 if the slot is free
+	uint8_t lifetime[PARTICLES_MAX];
+	uint8_t next_free[PARTICLES_MAX];
+	uint8_t free;                    // first free slot, or PARTICLES_NONE
+	int count;
+	uint32_t random;
+};
+
+void particles_init(struct particles *ps, uint32_t seed);
+
+/** Adds a particle living for lifetime (1..255) frames. Returns false if the pool is full. */
+bool particles_emit(struct particles *ps, int32_t pos, int32_t velocity, uint32_t color, int lifetime);
+
+/** Moves and ages all particles. Particles that leave the strip or reach the end of their life are freed. */
+void particles_update(struct particles *ps);
+
+/** Adds all particles to the bottom strips in led_data, saturating each channel */
+void particles_render(const struct particles *ps, volatile uint32_t led_data[]);
+
+/** Pseudo-random number for the emitters (xorshift32) */
+uint32_t particles_random(struct particles *ps);
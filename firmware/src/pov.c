@@ -0,0 +1,77 @@
+#include "pov.h"
+
+static const struct pov_run lane_runs[] = {
+	// dashed centre line
+	{ 24, 0x11 }, { 24, 0x00 },
+	{ 24, 0x11 }, { 24, 0x00 },
+	// red, green, blue markers
+	{ 8, 0x22 }, { 8, 0x00 }, { 8, 0x33 }, { 8, 0x00 }, { 8, 0x44 }, { 16, 0x00 },
+	// chevron, alternating between the strips
+	{ 6, 0x50 }, { 6, 0x55 }, { 6, 0x05 }, { 6, 0x00 },
+	{ 6, 0x50 }, { 6, 0x55 }, { 6, 0x05 }, { 30, 0x00 }
+};
+
+const struct pov_image pov_image_lane = {
+	.width = 224,
+	.n_runs = sizeof(lane_runs) / sizeof(*lane_runs),
+	.runs = lane_runs,
+	// black, white, red, green, blue, yellow
+	.palette = { 0x000000, 0x707070, 0x00ff00, 0xff0000, 0x0000ff, 0xb0ff00 }
+};
+
+void pov_frame(struct pov_frame *frame, const struct pov_image *image, fixed_t pos0, fixed_t velocity)
+{
+	// the 64 bit arithmetic happens here, once per frame. Wrapping x0 keeps the
+	// prediction within 32 bits however far the scooter went.
+	fixed_t period = (fixed_t)image->width << POV_COLUMN_SHIFT;
+	fixed_t x0 = ((pos0 * POV_PIXELS_PER_LED) >> (SHIFT - POV_COLUMN_SHIFT)) % period;
+	frame->x0 = x0 < 0 ? x0 + period : x0;
+	frame->velocity = ((velocity * POV_PIXELS_PER_LED) >> (SHIFT - POV_COLUMN_SHIFT)) / FPS;
+}
+
+int32_t pov_predict(const struct pov_frame *frame, uint32_t fraction)
+{
+	// a refresh comes at most a frame late: fraction < 2 * 65536. With 12 bits of
+	// it, the product fits up to 2^31 / 8192 / 256 / 4 = 256 LEDs per frame.
+	if (fraction >= 2 * 65536)
+		fraction = 2 * 65536 - 1;
+	int32_t dx = (frame->velocity * (int32_t)(fraction >> 4)) >> 12;
+	return (frame->x0 + dx) >> POV_COLUMN_SHIFT;
+}
+
+/** Returns the colors of the run that contains column x */
+static uint8_t column_colors(struct pov_cursor *cursor, int x)
+{
+	const struct pov_run *runs = cursor->image->runs;
+
+	if (x < cursor->x)
+	{
+		cursor->run = 0;
+		cursor->x = 0;
+	}
+	while (x >= cursor->x + runs[cursor->run].length)
+	{
+		cursor->x += runs[cursor->run].length;
+		cursor->run++;
+	}
+	return runs[cursor->run].colors;
+}
+
+void pov_render(volatile uint32_t led_data[], struct pov_cursor *cursor, int32_t column)
+{
+	const struct pov_image *image = cursor->image;
+	int32_t x0 = column % image->width;
+	if (x0 < 0)
+		x0 += image->width;
+
+	for (int i=0; i<N_BOTTOM; i++)
+	{
+		int x = x0 + i * POV_PIXELS_PER_LED;
+		while (x >= image->width)
+			x -= image->width;
+
+		uint8_t colors = column_colors(cursor, x);
+		led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM-1-i] = image->palette[colors >> 4];
+		led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM+i] = image->palette[colors & 0xF];
+	}
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <stdint.h>
+#include "common.h"
+
+/* POV module: paints images onto the road below the bottom strips.
+ *
+ * Resources: none
+ *
+ * The bottom strips run along the scooter. If every LED that passes over a
+ * spot of the road shows the colour of that spot, the image appears fixed to
+ * the road, at a resolution finer than the LED spacing. This only works if
+ * the LEDs are repainted more often than once per LED spacing travelled. At
+ * 60 fps, that limits the speed to 1 m/s, so the WS2812 driver repaints the
+ * strips at the start of every refresh (about 240 Hz), at the position
+ * predicted from the last frame and the speed.
+ *
+ * Images have two rows, one per bottom strip, and repeat along the road. They
+ * are stored in flash, run-length encoded by ../host/pov_encode.py, and decoded
+ * column by column while painting.
+ *
+ * Usage:
+ *   - pov_frame(&frame, image, pos0, velocity) once per frame
+ *   - pov_render(led_data, &cursor, pov_predict(&frame, fraction)) at any time
+ *     in between, with the time elapsed since the frame in 1/65536 frames.
+ *     Both only use 32 bit arithmetic, as they run in the WS2812 interrupt.
+ */
+
+/** Image columns per LED spacing */
+#define POV_PIXELS_PER_LED 4
+
+/** length columns in which the first strip shows palette[colors >> 4] and the
+  * second one palette[colors & 0xF] */
+struct pov_run
+{
+	uint8_t length;
+	uint8_t colors;
+};
+
+struct pov_image
+{
+	uint16_t width; // in columns
+	uint16_t n_runs;
+	const struct pov_run *runs;
+	uint32_t palette[16]; // 0x00GGRRBB
+};
+
+/** Position of the decoder in an image. Painting moves it forward; moving
+  * backwards restarts it at the beginning of the image. */
+struct pov_cursor
+{
+	const struct pov_image *image;
+	uint16_t run;
+	uint16_t x; // first column of run
+};
+
+/** Fractional bits of the columns in struct pov_frame */
+#define POV_COLUMN_SHIFT 8
+
+struct pov_frame
+{
+	int32_t x0;       // column at the start of the frame, within 0..width, POV_COLUMN_SHIFT fractional bits
+	int32_t velocity; // in columns per frame, POV_COLUMN_SHIFT fractional bits
+};
+
+extern const struct pov_image pov_image_lane;
+
+void pov_frame(struct pov_frame *frame, const struct pov_image *image, fixed_t pos0, fixed_t velocity);
+
+/** Column at fraction/65536 frames after the frame started. It is not wrapped to
+  * the image width, pov_render() does that. */
+int32_t pov_predict(const struct pov_frame *frame, uint32_t fraction);
+
+/** Paints the image onto the bottom strips, with the given column of the image at
+  * the rear end. The image has its first column at position 0. */
+void pov_render(volatile uint32_t led_data[], struct pov_cursor *cursor, int32_t column);
@@ -0,0 +1,39 @@
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/exti.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/pwr.h>
+#include <libopencm3/cm3/scb.h>
+
+#include "power.h"
+#include "clock.h"
+
+#define WAKE_LINES (EXTI8 | EXTI10)
+
+void power_stop(void)
+{
+	rcc_periph_clock_enable(RCC_AFIO);
+	rcc_periph_clock_enable(RCC_PWR);
+
+	// the hall sensor wakes up on both edges, the button when pressed
+	exti_select_source(EXTI8, GPIOA);
+	exti_set_trigger(EXTI8, EXTI_TRIGGER_BOTH);
+	exti_select_source(EXTI10, GPIOB);
+	exti_set_trigger(EXTI10, EXTI_TRIGGER_RISING);
+	exti_reset_request(WAKE_LINES);
+	EXTI_EMR |= WAKE_LINES;
+
+	pwr_set_stop_mode();
+	pwr_voltage_regulator_low_power_in_stop();
+	SCB_SCR |= SCB_SCR_SLEEPDEEP;
+
+	// sev sets the event register and the first wfe clears it, so that a
+	// stale event does not end the second wfe, which waits for EXTI
+	__asm__("sev\n\twfe\n\twfe");
+
+	SCB_SCR &= ~SCB_SCR_SLEEPDEEP;
+	EXTI_EMR &= ~WAKE_LINES;
+	exti_reset_request(WAKE_LINES);
+
+	// STOP mode leaves the MCU on the HSI
+	clock_set(clock_mode);
+}
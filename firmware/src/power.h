@@ -0,0 +1,22 @@
+#pragma once
+
+/* Power module: STOP mode while the scooter is parked.
+ *
+ * Resources:
+ *   - PWR
+ *   - EXTI8 on PA8 (the default tacho sensor) and EXTI10 on PB10 (the button),
+ *     as events. Both pins keep their other function.
+ *
+ * In STOP mode, all clocks halt and the MCU draws some 20 uA. The WS2812 LEDs
+ * keep drawing their idle current (about 1 mA each, see powerlimit.h), which
+ * dominates unless their supply is switched off.
+ *
+ * Usage:
+ *   - stop everything that must not run while parked (ws2812_stop())
+ *   - call power_stop(); it returns after a hall edge or a button press, with
+ *     the previous clock mode running again
+ *   - restart what was stopped
+ */
+
+/** Enters STOP mode until PA8 or PB10 changes */
+void power_stop(void);
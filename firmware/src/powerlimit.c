@@ -0,0 +1,45 @@
+#include "powerlimit.h"
+#include "common.h"
+#include "math.h"
+
+/* raising the limit by this step per frame takes it from 0 to 1000 in half a second */
+#define RISE_PERMILLE (1000 / FPS * 2)
+
+void powerlimit_init(struct powerlimit *pl)
+{
+	pl->limit = 1000;
+}
+
+int powerlimit_cap_ma(int batt_percent)
+{
+	int percent = clamp(batt_percent, 0, POWERLIMIT_FULL_PERCENT);
+	return POWERLIMIT_CAP_EMPTY_MA + (POWERLIMIT_CAP_MA - POWERLIMIT_CAP_EMPTY_MA) * percent / POWERLIMIT_FULL_PERCENT;
+}
+
+int powerlimit_update(struct powerlimit *pl, int fixed_ma, int scaled_ma, int cap_ma)
+{
+	int budget = cap_ma - fixed_ma;
+
+	if (budget <= 0)
+	{
+		pl->limit = 0;
+	}
+	else if (scaled_ma > budget)
+	{
+		// the current scales with about limit^2.8, so reducing the limit by
+		// a third of the excess nearly corrects it, without overshooting
+		int excess = scaled_ma - budget;
+		pl->limit -= pl->limit * excess / scaled_ma / 3 + 1;
+	}
+	else if (pl->limit < 1000)
+	{
+		// predict the current after the step the same way. The refresh that
+		// was measured may not include the previous step yet, so count it twice.
+		int step = RISE_PERMILLE;
+		if (pl->limit == 0 || scaled_ma + scaled_ma * 3 * 2 * step / pl->limit <= budget)
+			pl->limit += step;
+	}
+
+	pl->limit = clamp(pl->limit, 0, 1000);
+	return pl->limit;
+}
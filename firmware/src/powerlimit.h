@@ -0,0 +1,67 @@
+#pragma once
+#include <stdint.h>
+
+/* Power limiter module: keeps the estimated LED current below a cap.
+ *
+ * Resources: none
+ *
+ * The WS2812 encoder estimates the current of each refresh from the duty it
+ * sends, see powerlimit_led_current(). LEDs sent through the brightness
+ * dependent table (the bottom strips) are counted separately from all others.
+ * The limiter then scales the bottom strips' brightness so that both together
+ * stay below the cap. The cap is lowered as the battery empties, where the
+ * converter browns out first.
+ *
+ * Scaling the brightness before the gamma curve scales the current by about
+ * brightness^2.8. The limit thus reacts to an excess within a few frames, and
+ * creeps back up only while the predicted current stays below the cap.
+ *
+ * Usage:
+ *   - call powerlimit_init(&pl) once
+ *   - the encoder sums powerlimit_led_current() over all LEDs, and passes the
+ *     sums to powerlimit_ma() once per refresh
+ *   - call powerlimit_update() once per frame and scale the brightness by
+ *     its result
+ */
+
+/* Cap in mA for the LEDs. The LM2596 delivers 3 A, minus the MCU and a margin. */
+#define POWERLIMIT_CAP_MA 2500
+/* Cap at 0% battery. It rises linearly up to POWERLIMIT_CAP_MA at POWERLIMIT_FULL_PERCENT. */
+#define POWERLIMIT_CAP_EMPTY_MA 1000
+#define POWERLIMIT_FULL_PERCENT 50
+
+/* Current per WS2812 channel at full duty, and per LED when dark, in mA */
+#define POWERLIMIT_LED_MA_G 12
+#define POWERLIMIT_LED_MA_R 12
+#define POWERLIMIT_LED_MA_B 12
+#define POWERLIMIT_LED_IDLE_MA 1
+
+struct powerlimit
+{
+	int limit; // permille
+};
+
+/** The current of one LED, sent as 0x00GGRRBB, in 1/255 mA */
+static inline uint32_t powerlimit_led_current(uint32_t v)
+{
+	return ((v >> 16) & 0xFF) * POWERLIMIT_LED_MA_G +
+		((v >> 8) & 0xFF) * POWERLIMIT_LED_MA_R +
+		(v & 0xFF) * POWERLIMIT_LED_MA_B;
+}
+
+/** Converts a sum of powerlimit_led_current() over n_leds LEDs to mA */
+static inline int powerlimit_ma(uint32_t sum, int n_leds)
+{
+	return sum / 255 + n_leds * POWERLIMIT_LED_IDLE_MA;
+}
+
+void powerlimit_init(struct powerlimit *pl);
+
+/** The cap for the given battery charge, in mA */
+int powerlimit_cap_ma(int batt_percent);
+
+/** Updates the limit from the last refresh's current.
+  * fixed_ma: current of the LEDs that are not scaled by the brightness
+  * scaled_ma: current of the LEDs that are, at the brightness that was sent
+  * Returns the brightness limit in permille. */
+int powerlimit_update(struct powerlimit *pl, int fixed_ma, int scaled_ma, int cap_ma);
@@ -0,0 +1,96 @@
+#include <libopencm3/cm3/sync.h>
+
+#include "sensors.h"
+#include "math.h"
+
+/* A double-buffered reading. Publication n writes data[n & 1], then sets seq = n.
+ * A reader copies data[seq & 1]. That copy can only be torn if the producer
+ * published twice meanwhile (which wrote the same buffer again), so the reader
+ * retries if seq advanced by 2 or more. A reader that interrupts the producer
+ * never has to wait: the producer is writing the other buffer. */
+struct channel
+{
+	volatile uint32_t seq;
+	uint32_t data[2];
+};
+
+static struct channel tacho_frequency;
+static struct channel tacho_slip;
+static struct channel adc = { 0, { (uint32_t)-1, (uint32_t)-1 } };
+static struct channel button;
+static struct channel brake;
+static struct channel led_current; // fixed_ma << 16 | scaled_ma
+
+static volatile uint32_t tacho_edges = 0;
+
+static void publish(struct channel *ch, uint32_t value)
+{
+	uint32_t next = ch->seq + 1;
+	ch->data[next & 1] = value;
+	__dmb();
+	ch->seq = next;
+}
+
+static uint32_t read(const struct channel *ch)
+{
+	while (1)
+	{
+		uint32_t seq = ch->seq;
+		__dmb();
+		uint32_t value = ch->data[seq & 1];
+		__dmb();
+		if (ch->seq - seq < 2)
+			return value;
+	}
+}
+
+void sensors_publish_tacho(uint32_t frequency_millihertz)
+{
+	publish(&tacho_frequency, frequency_millihertz);
+}
+
+void sensors_publish_slip(int32_t slip_permille)
+{
+	publish(&tacho_slip, slip_permille);
+}
+
+void sensors_publish_adc(int adc_value)
+{
+	publish(&adc, adc_value);
+}
+
+void sensors_publish_button(int button_pressed)
+{
+	publish(&button, button_pressed);
+}
+
+void sensors_publish_brake(int braking)
+{
+	publish(&brake, braking);
+}
+
+void sensors_publish_led_current(int fixed_ma, int scaled_ma)
+{
+	publish(&led_current, ((uint32_t)clamp(fixed_ma, 0, 0xFFFF) << 16) | clamp(scaled_ma, 0, 0xFFFF));
+}
+
+void sensors_count_edge(void)
+{
+	uint32_t value;
+	do {
+		value = __ldrex(&tacho_edges);
+	} while (__strex(value + 1, &tacho_edges));
+}
+
+void sensors_snapshot(struct sensor_state *state)
+{
+	state->frequency_millihertz = read(&tacho_frequency);
+	state->tacho_edges = tacho_edges;
+	state->slip_permille = read(&tacho_slip);
+	state->adc_value = read(&adc);
+	state->button_pressed = read(&button);
+	state->braking = read(&brake);
+	uint32_t led = read(&led_current);
+	state->led_current_fixed_ma = led >> 16;
+	state->led_current_scaled_ma = led & 0xFFFF;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+
+/* Sensor state module: consistent snapshots of all sensor readings, without masking interrupts.
+ *
+ * Resources: none
+ *
+ * Every producer (tacho, brake detector, ADC, button, LED encoder) owns a double buffer with a sequence counter.
+ * Publishing writes the buffer that readers are not using and then bumps the
+ * counter, so a reader never sees a half-written reading, no matter whether it
+ * interrupts the producer or is interrupted by it. Interrupts are never disabled,
+ * so the WS2812 DMA interrupt's latency is not affected.
+ *
+ * Usage:
+ *   - producers call sensors_publish_*() whenever they have a new reading
+ *   - the renderer calls sensors_snapshot() once per frame
+ *   - each producer must only be called from one context (e.g. one ISR)
+ */
+
+struct sensor_state
+{
+	/* tacho */
+	uint32_t frequency_millihertz;
+	uint32_t tacho_edges; // number of tacho edges since boot, all sensors
+	int32_t slip_permille; // (wheel 0 - wheel 1) / faster wheel frequency, 0 without a sensor on wheel 1
+
+	/* ADC: the filtered reading, or -1 if there is none yet */
+	int adc_value;
+
+	/* button: debounced state */
+	int button_pressed;
+
+	/* brake detector (see tacho_poll_brake()) */
+	int braking;
+
+	/* estimated LED current of the last refresh, see powerlimit.h */
+	int led_current_fixed_ma;
+	int led_current_scaled_ma;
+};
+
+void sensors_publish_tacho(uint32_t frequency_millihertz);
+void sensors_publish_slip(int32_t slip_permille);
+void sensors_publish_adc(int adc_value);
+void sensors_publish_button(int button_pressed);
+void sensors_publish_brake(int braking);
+void sensors_publish_led_current(int fixed_ma, int scaled_ma);
+
+/** Counts a tacho edge. May be called from any context; this is an atomic
+  * read-modify-write (LDREX/STREX). */
+void sensors_count_edge(void);
+
+/** Copies the latest readings into *state. Each producer's readings are
+  * consistent among themselves; different producers are independent. */
+void sensors_snapshot(struct sensor_state *state);
@@ -30,158 +30,269 @@
 #include <libopencm3/stm32/timer.h>
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/rcc.h>
-#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/stm32/dma.h>
 #include <stdio.h>
-#include <stdlib.h>
-#include <limits.h>
 #include "tacho.h"
+#include "tacho_estimator.h"
+#ifdef TACHO_TRACE
+#include "tachotrace.h"
+#endif
+#include "sensors.h"
+#include "clock.h"
 
-volatile uint32_t frequency_millihertz = 0;
-static bool overflow = true;
+/* The capture channels that can be used. TIM1_CH2 is missing, because its DMA
+ * channel (DMA1 channel 3) is taken by the WS2812 driver. CH3 shares PA10 with
+ * the UART's RX. */
+struct tacho_channel
+{
+	int number;
+	uint16_t gpio;
+	enum tim_ic_id ic;
+	enum tim_ic_input input;
+	volatile uint32_t *ccr;
+	uint32_t dma_enable;
+	uint8_t dma_channel;
+};
+
+static const struct tacho_channel TACHO_CH1 = { 1, GPIO_TIM1_CH1, TIM_IC1, TIM_IC_IN_TI1, &TIM1_CCR1, TIM_DIER_CC1DE, DMA_CHANNEL2 }; // PA8
+static const struct tacho_channel TACHO_CH3 = { 3, GPIO_TIM1_CH3, TIM_IC3, TIM_IC_IN_TI3, &TIM1_CCR3, TIM_DIER_CC3DE, DMA_CHANNEL6 }; // PA10
+static const struct tacho_channel TACHO_CH4 = { 4, GPIO_TIM1_CH4, TIM_IC4, TIM_IC_IN_TI4, &TIM1_CCR4, TIM_DIER_CC4DE, DMA_CHANNEL4 }; // PA11
+
+#define N_CAPTURES 16
+
+struct tacho
+{
+	/* configuration */
+	const struct tacho_channel *channel;
+	int wheel; // 0 is the wheel whose speed drives the patterns, 1 the other one
+	const uint32_t *distances;
+	int n_magnets;
+
+	/* state */
+	volatile uint16_t captures[N_CAPTURES];
+	unsigned capture_idx;       // next entry in captures[] to be processed by tacho_update()
+	unsigned brake_capture_idx; // same for tacho_poll_brake()
+	struct tacho_estimator estimator;
+	struct tacho_brake brake;
+};
 
 
 /* CONFIGURATION SECTION
- * change these values to account for your magnet configuration. see learn.py and the README */
-#define N_MAGNETS 5
-static const uint32_t DISTANCES[N_MAGNETS] = {69340993, 61923605, 64606495, 65695792, 66113112};
+ * change these values to account for your magnet configuration. see learn.py and the README.
+ * every sensor has its own magnet calibration. sensors on the same wheel are fused,
+ * a sensor on the other wheel is used for slip detection. */
+static const uint32_t DISTANCES_0[] = {69340993, 61923605, 64606495, 65695792, 66113112};
+
+static struct tacho tachos[] = {
+	{ .channel = &TACHO_CH1, .wheel = 0, .distances = DISTANCES_0, .n_magnets = sizeof(DISTANCES_0)/sizeof(*DISTANCES_0) },
+	// a second sensor, e.g. on the other wheel:
+	//{ .channel = &TACHO_CH4, .wheel = 1, .distances = DISTANCES_1, .n_magnets = sizeof(DISTANCES_1)/sizeof(*DISTANCES_1) },
+};
 /* end of configuration section */
 
-static uint32_t backlog[N_MAGNETS];
-static int phase = 0;
+#define N_TACHOS (sizeof(tachos) / sizeof(*tachos))
+
+/* TIM1 runs freely with a 1us tick and is shared by all sensors. Every rising
+ * edge is captured and copied to the sensor's captures[] by DMA; no interrupt is
+ * involved. The 16 bit timestamps are extended to 32 bit, which works as long as
+ * they are processed at least every 65ms. Intervals are therefore 32 bit as well:
+ * walking pace, where an interval spans more than one timer period, is measured up to
+ * the standstill timeout (TACHO_TIMEOUT_US) instead of reading as a standstill,
+ * and an interval of 4096 ticks (12 bits of resolution) still corresponds to
+ * about 30 m/s, so no prescaler ranging is needed. The prescaler follows the core clock
+ * (see tacho_retime()), so the tick stays at 1us in every clock mode. */
+
+static bool initialized = false;
+static uint16_t last_count = 0;   // timer count at the previous tacho_update()
+static uint32_t now = 0;          // timer count at the current tacho_update(), extended to 32 bit
 
-static void put_backlog(uint32_t value)
+static uint16_t brake_last_count = 0;
+static uint32_t brake_now = 0;
+static bool braking = false;
+volatile uint32_t tacho_brake_onset = 0;
+
+/** Reads the DMA positions of all sensors into end[], then the timer. Every
+  * capture up to the DMA positions was taken before the counter was read. */
+static uint16_t read_positions(unsigned end[])
 {
-	for (int i=1; i<N_MAGNETS; i++)
-		backlog[i-1] = backlog[i];
-	backlog[N_MAGNETS-1] = value;
-
-	/*printf("backlog: ");
-	for (int i=0; i<N_MAGNETS; i++)
-		printf("%ld, ", backlog[i]);
-	printf("\n");*/
+	for (unsigned i=0; i<N_TACHOS; i++)
+		end[i] = (N_CAPTURES - dma_get_number_of_data(DMA1, tachos[i].channel->dma_channel)) % N_CAPTURES;
+	return timer_get_counter(TIM1);
 }
 
-static int detect_phase(void)
+void tacho_update(void)
 {
-	uint32_t timestamps[N_MAGNETS] = {0};
-	for (int i=1; i<N_MAGNETS; i++)
-		timestamps[i] = timestamps[i-1] + backlog[i-1];
-
-	int best_offset = -2;
-	int best_reldiff = INT_MAX;
-	int secondbest_reldiff = INT_MAX;
-
+	unsigned end[N_TACHOS];
+#ifdef TACHO_TRACE
+	// UIF is sampled and cleared before the count is read, so a wrap in between
+	// cannot be taken for one before the previous count (URS keeps the prescaler
+	// updates from setting UIF)
+	bool wrapped = timer_get_flag(TIM1, TIM_SR_UIF);
+	timer_clear_flag(TIM1, TIM_SR_UIF);
+#endif
+	uint16_t count = read_positions(end);
+#ifdef TACHO_TRACE
+	// a wrap right after clearing is already contained in a small count; one right
+	// after reading belongs to the next call
+	if (timer_get_flag(TIM1, TIM_SR_UIF) && count < 0x8000)
+		timer_clear_flag(TIM1, TIM_SR_UIF);
+	// TIM1 wrapped, but the count did not go back: more than 65ms passed since the last call
+	if (wrapped && count >= last_count)
+		tachotrace_overflow();
+#endif
+	now += (uint16_t)(count - last_count);
+	last_count = count;
 
-	for (int phase_offset=0; phase_offset<N_MAGNETS; phase_offset++)
+	for (unsigned i=0; i<N_TACHOS; i++)
 	{
-		//printf("with phase_offset = %d: ", phase_offset);
-		int32_t freqs[N_MAGNETS]; // millihertz
-		for (int i=0; i<N_MAGNETS; i++)
-			freqs[i] = DISTANCES[(i+phase_offset)%N_MAGNETS] / backlog[i];
-
-		int32_t reldiff_max = 0;
-		for (int i=0; i<N_MAGNETS; i++)
+		struct tacho *tacho = &tachos[i];
+		for (; tacho->capture_idx != end[i]; tacho->capture_idx = (tacho->capture_idx + 1) % N_CAPTURES)
 		{
-			int32_t diff = freqs[i] - (freqs[0] + ((int64_t)timestamps[i]) * (freqs[N_MAGNETS-1] - freqs[0]) / timestamps[N_MAGNETS-1]);
-			int32_t reldiff = 1000 * diff / freqs[0];
-			//printf("%ld, ", reldiff);
-			if (abs(reldiff) > reldiff_max)
-				reldiff_max = abs(reldiff);
+			uint32_t interval = tacho_estimator_edge(&tacho->estimator, now - (uint16_t)(count - tacho->captures[tacho->capture_idx]));
+			sensors_count_edge();
+#ifdef TACHO_LOG
+			// in units of TACHO_CALIB_PRESCALER cycles, for learn.py
+			if (interval)
+				printf("TIM1_CCR%d = %lu\n", tacho->channel->number, interval * TACHO_CALIB_CYCLES_PER_US / TACHO_CALIB_PRESCALER);
+#else
+			(void) interval;
+#endif
+#ifdef TACHO_TRACE
+			tachotrace_edge(i, interval, tacho->estimator.frequency_millihertz, tacho->estimator.phase);
+#endif
 		}
-		//printf(" => %ld\n", reldiff_max);
+	}
 
-		if (reldiff_max <= best_reldiff)
+	/* fuse the sensors: for every wheel, the sensor with the most recent edge
+	 * has the most recent estimate */
+	uint32_t frequency[2] = {0, 0};
+	uint32_t age[2] = {0, 0};
+	bool seen[2] = {false, false};
+	for (unsigned i=0; i<N_TACHOS; i++)
+	{
+		struct tacho *tacho = &tachos[i];
+		uint32_t f = tacho_estimator_frequency(&tacho->estimator, now);
+		uint32_t edge_age = now - tacho->estimator.last_edge;
+		if (!seen[tacho->wheel] || edge_age < age[tacho->wheel])
 		{
-			secondbest_reldiff = best_reldiff;
-			best_reldiff = reldiff_max;
-			best_offset = phase_offset;
+			seen[tacho->wheel] = true;
+			age[tacho->wheel] = edge_age;
+			frequency[tacho->wheel] = f;
 		}
-		else if (reldiff_max <= secondbest_reldiff)
+	}
+
+	sensors_publish_tacho(frequency[0]);
+
+	if (seen[1])
+	{
+		uint32_t fmax = frequency[0] > frequency[1] ? frequency[0] : frequency[1];
+		int32_t slip = fmax ? (int32_t)((int64_t)1000 * ((int64_t)frequency[0] - frequency[1]) / fmax) : 0;
+		sensors_publish_slip(slip);
+	}
+}
+
+bool tacho_poll_brake(void)
+{
+	unsigned end[N_TACHOS];
+	uint16_t count = read_positions(end);
+	brake_now += (uint16_t)(count - brake_last_count);
+	brake_last_count = count;
+
+	bool any_braking = false;
+	for (unsigned i=0; i<N_TACHOS; i++)
+	{
+		struct tacho *tacho = &tachos[i];
+		for (; tacho->brake_capture_idx != end[i]; tacho->brake_capture_idx = (tacho->brake_capture_idx + 1) % N_CAPTURES)
 		{
-			secondbest_reldiff = reldiff_max;
+			uint32_t timestamp = brake_now - (uint16_t)(count - tacho->captures[tacho->brake_capture_idx]);
+			if (tacho_brake_edge(&tacho->brake, timestamp) && !braking)
+				tacho_brake_onset = timestamp;
 		}
+		any_braking |= tacho_brake_poll(&tacho->brake, brake_now);
 	}
 
-	int confidence = 100 * (secondbest_reldiff - best_reldiff) / (best_reldiff+1); // relative difference between best and second best in percent
-	//printf("best phase offset: %d, confidence: %d\n", best_offset, confidence);
-	if (confidence > 150)
-		return (best_offset+N_MAGNETS-1) % N_MAGNETS;
-	else
-		return -1;
+	if (any_braking != braking)
+	{
+		braking = any_braking;
+		sensors_publish_brake(braking);
+	}
+
+	return braking;
 }
 
-/** Tacho rising edge interrupt */
-void tim1_cc_isr(void)
+#ifdef TACHO_TRACE
+void tacho_trace_dump(void)
 {
-	timer_clear_flag(TIM1, TIM_SR_CC1IF);
-	printf("TIM1_CCR1 = %lu\n", TIM1_CCR1);
-
-	put_backlog(TIM1_CCR1);
-	phase = (phase+1) % N_MAGNETS;
-	int detected_phase = detect_phase();
-	if (detected_phase != -1 && detected_phase != phase)
+	for (unsigned i=0; i<N_TACHOS; i++)
 	{
-		//printf("PHASE JUMP DETECTED! expected %d, detected %d\n", phase, detected_phase);
-		phase = detected_phase;
+		printf("trace distances %u", i);
+		for (int k=0; k<tachos[i].n_magnets; k++)
+			printf(" %lu", (unsigned long)tachos[i].distances[k]);
+		printf("\n");
 	}
-	
-	//printf("tim1_cc_isr %d %d\n", TIM1_CCR1, timer_get_flag(TIM1, TIM_SR_CC1OF));
-	if (!overflow)
-		frequency_millihertz = DISTANCES[phase] / (uint32_t)TIM1_CCR1 / N_MAGNETS;
-	overflow = false;
-	//printf("%d mHz\n", frequency_millihertz);
+	tachotrace_dump();
 }
+#endif
 
-/** Timer overflow interrupt */
-void tim1_up_isr(void)
+void tacho_retime(void)
 {
-	timer_clear_flag(TIM1, TIM_SR_UIF);
-	//printf("tim1_up_isr, %d\n", timer_get_counter(TIM1));
+	if (initialized)
+		clock_set_prescaler(TIM1, clock_mhz - 1);
+}
 
-	frequency_millihertz = 0;
-	overflow = true;
+uint32_t tacho_brake_now(void)
+{
+	return brake_now + (uint16_t)(timer_get_counter(TIM1) - brake_last_count);
 }
 
 void tacho_init(void)
 {
 	rcc_periph_clock_enable(RCC_TIM1);
+	rcc_periph_clock_enable(RCC_DMA1);
 	rcc_periph_reset_pulse(RST_TIM1);
 
-	// Configure GPIOs: tacho in = PA8
-	gpio_set_mode(GPIOA, GPIO_MODE_INPUT,
-	    GPIO_CNF_INPUT_PULL_UPDOWN, GPIO_TIM1_CH1);
-	gpio_set(GPIOA, GPIO_TIM1_CH1);
-
 	// Configure the basic timer stuff
 	timer_set_mode(TIM1, TIM_CR1_CKD_CK_INT_MUL_4, TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
 	timer_disable_preload(TIM1);
 	timer_continuous_mode(TIM1);
-	timer_update_on_overflow(TIM1); // that means: generate update events *only* on overflows,
-	                                // not on e.g. reset through the trigger input.
 	timer_set_period(TIM1, 0xFFFF); // full scale
-	timer_set_prescaler(TIM1, 72000000L / 65536 - 1); // TODO FIXME
-
-	// Configure input capture on channel 1 (=PA8).
-	// Every rising edge on PA8 will cause TIM1_CCR1 to be loaded with the current timer value
-	// and tim1_cc_isr() to be called.
-	timer_ic_set_input(TIM1, TIM_IC1, TIM_IC_IN_TI1);
-	timer_ic_set_polarity(TIM1, TIM_IC1, TIM_IC_RISING);
-	timer_ic_set_filter(TIM1, TIM_IC1, TIM_IC_CK_INT_N_8);
-	timer_ic_enable(TIM1, TIM_IC1);
-
-	// Configure reset on every rising edge of channel 1.
-	timer_slave_set_filter(TIM1, TIM_IC_CK_INT_N_8);
-	timer_slave_set_trigger(TIM1, TIM_SMCR_TS_TI1FP1); // trigger input := CH1
-	timer_slave_set_mode(TIM1, TIM_SMCR_SMS_RM); // timer reset on trigger input
-
-	// Configure the interrupts
-	nvic_enable_irq(NVIC_TIM1_UP_IRQ); // Update interrupt (tim1_up_isr) is called on overflow.
-	nvic_enable_irq(NVIC_TIM1_CC_IRQ); // Capture/Compare interrupt (tim1_cc_isr) is called on every rising edge.
-	nvic_set_priority(NVIC_TIM1_UP_IRQ, 0xf << 4); // Set lowest priority in order to not interfere
-	nvic_set_priority(NVIC_TIM1_CC_IRQ, 0xf << 4); // with the timing critical WS2812 driver
-	timer_enable_irq(TIM1, TIM_DIER_UIE | TIM_DIER_CC1IE);
+	timer_set_prescaler(TIM1, clock_mhz - 1);
+
+	for (unsigned i=0; i<N_TACHOS; i++)
+	{
+		struct tacho *tacho = &tachos[i];
+		const struct tacho_channel *ch = tacho->channel;
+
+		tacho_estimator_init(&tacho->estimator, tacho->distances, tacho->n_magnets);
+		tacho_brake_init(&tacho->brake, tacho->n_magnets);
+
+		// Configure GPIOs: all channels are on GPIOA, with pull-up
+		gpio_set_mode(GPIOA, GPIO_MODE_INPUT,
+		    GPIO_CNF_INPUT_PULL_UPDOWN, ch->gpio);
+		gpio_set(GPIOA, ch->gpio);
+
+		// Configure input capture. Every rising edge will cause the CCR to be loaded
+		// with the current timer value, which is then transferred to captures[] by DMA.
+		timer_ic_set_input(TIM1, ch->ic, ch->input);
+		timer_ic_set_polarity(TIM1, ch->ic, TIM_IC_RISING);
+		timer_ic_set_filter(TIM1, ch->ic, TIM_IC_CK_INT_N_8);
+		timer_ic_enable(TIM1, ch->ic);
+
+		dma_channel_reset(DMA1, ch->dma_channel);
+		dma_set_peripheral_address(DMA1, ch->dma_channel, (uint32_t)ch->ccr);
+		dma_set_memory_address(DMA1, ch->dma_channel, (uint32_t)tacho->captures);
+		dma_set_number_of_data(DMA1, ch->dma_channel, N_CAPTURES);
+		dma_set_read_from_peripheral(DMA1, ch->dma_channel);
+		dma_enable_memory_increment_mode(DMA1, ch->dma_channel);
+		dma_set_peripheral_size(DMA1, ch->dma_channel, DMA_CCR_PSIZE_16BIT);
+		dma_set_memory_size(DMA1, ch->dma_channel, DMA_CCR_MSIZE_16BIT);
+		dma_set_priority(DMA1, ch->dma_channel, DMA_CCR_PL_LOW); // below the WS2812 channel
+		dma_enable_circular_mode(DMA1, ch->dma_channel);
+		dma_enable_channel(DMA1, ch->dma_channel);
+		timer_enable_irq(TIM1, ch->dma_enable); // in fact, enable DMA on capture
+	}
 
 	// Start the timer
 	timer_enable_counter(TIM1);
+	initialized = true;
 }
-
@@ -28,17 +28,64 @@
 
 #pragma once
 #include <stdint.h>
+#include <stdbool.h>
 
 /* Tacho module
  *
  * Resources:
  *   - TIM1
- *   - GPIO PA8 as measurement pin
+ *   - per sensor, one of:
+ *       - TIM1_CH1: GPIO PA8 and DMA1 channel 2 (the default sensor)
+ *       - TIM1_CH3: GPIO PA10 and DMA1 channel 6 (conflicts with the UART's RX)
+ *       - TIM1_CH4: GPIO PA11 and DMA1 channel 4
  *
  * Usage:
  *   - call tacho_init();
- *   - frequency_millihertz will contain the frequency measurement
+ *   - call tacho_update() once per frame, at least every 65ms
+ *   - the frequency measurement is published to the sensors module, see sensors.h
+ *
+ * The edges are timestamped by TIM1 input capture and collected by DMA, so they
+ * cause no interrupts. tacho_update() processes all edges since its last call.
+ * Without an edge for 3 seconds, the speed is reported as 0.
+ *
+ * Several sensors can be configured in tacho.c, each with its own magnet
+ * calibration. Sensors on the same wheel are fused by always using the one
+ * with the most recent edge; a sensor on the other wheel yields the slip.
+ * The estimation itself is in tacho_estimator.c.
+ *
+ * The brake detector looks at the same captures, but is polled far more often
+ * (from the WS2812 DMA interrupt), so braking is signalled within about a
+ * millisecond after the first edge that shows the deceleration.
+ *
+ * Build with `make TACHO_LOG=1` to print the edge intervals for learn.py,
+ * as "TIM1_CCR<channel> = <interval>".
+ *
+ * Build with `make TACHO_TRACE=1` to record the edges and the estimator's output
+ * in RAM instead (see tachotrace.h), and print them with tacho_trace_dump().
  */
 
-extern volatile uint32_t frequency_millihertz;
 void tacho_init(void);
+
+#ifdef TACHO_TRACE
+/** Prints the magnet distances of every sensor and the trace.
+  * tacho_update() must not run meanwhile. */
+void tacho_trace_dump(void);
+#endif
+
+/** Adapts TIM1 to a new clock_mhz, keeping the 1us tick and the count. Called by clock_set(). */
+void tacho_retime(void);
+
+/** Processes the captured edges and publishes the new frequency estimate */
+void tacho_update(void);
+
+/** Checks the captured edges for a deceleration and publishes the brake state.
+  * Returns true while braking. Must be called from a single context, often
+  * enough that the TIM1 counter does not wrap (65ms) */
+bool tacho_poll_brake(void);
+
+/** Current time in microseconds, in the same timebase as tacho_brake_onset.
+  * Only valid in the context calling tacho_poll_brake(). */
+uint32_t tacho_brake_now(void);
+
+/** Timestamp of the edge that started the current braking, in microseconds */
+extern volatile uint32_t tacho_brake_onset;
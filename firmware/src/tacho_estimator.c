@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <limits.h>
+
+#include "tacho_estimator.h"
+
+/* Brake detection thresholds, in wheel revolutions. With a 66cm wheel,
+ * 2300 mHz/s are about 1.5 m/s^2 and 1000 mHz are 2.4 km/h. */
+#define BRAKE_DECELERATION_MILLIHERTZ_PER_S 2300
+#define BRAKE_MIN_MILLIHERTZ 1000
+#define BRAKE_HOLD_US 300000 // braking lasts this long after the last decelerating edge
+
+/** Converts a magnet distance and a time in microseconds to millihertz */
+static uint32_t distance_to_millihertz(uint32_t distance, uint32_t us)
+{
+	return (uint64_t)distance * TACHO_CALIB_PRESCALER / ((uint64_t)us * TACHO_CALIB_CYCLES_PER_US);
+}
+
+void tacho_estimator_init(struct tacho_estimator *est, const uint32_t *distances, int n_magnets)
+{
+	est->distances = distances;
+	est->n_magnets = n_magnets;
+	est->valid = false;
+	est->last_edge = 0;
+	est->frequency_millihertz = 0;
+	for (int i=0; i<TACHO_MAX_MAGNETS; i++)
+		est->backlog[i] = 0;
+	est->phase = 0;
+}
+
+static void put_backlog(struct tacho_estimator *est, uint32_t value)
+{
+	for (int i=1; i<est->n_magnets; i++)
+		est->backlog[i-1] = est->backlog[i];
+	est->backlog[est->n_magnets-1] = value;
+}
+
+static int detect_phase(const struct tacho_estimator *est)
+{
+	const int n = est->n_magnets;
+
+	// not enough intervals seen yet
+	for (int i=0; i<n; i++)
+		if (est->backlog[i] == 0)
+			return -1;
+
+	uint32_t timestamps[TACHO_MAX_MAGNETS] = {0};
+	for (int i=1; i<n; i++)
+		timestamps[i] = timestamps[i-1] + est->backlog[i-1];
+
+	int best_offset = -2;
+	int best_reldiff = INT_MAX;
+	int secondbest_reldiff = INT_MAX;
+
+
+	for (int phase_offset=0; phase_offset<n; phase_offset++)
+	{
+		int32_t freqs[TACHO_MAX_MAGNETS]; // millihertz
+		for (int i=0; i<n; i++)
+			freqs[i] = distance_to_millihertz(est->distances[(i+phase_offset)%n], est->backlog[i]);
+
+		if (freqs[0] == 0)
+			continue;
+
+		int32_t reldiff_max = 0;
+		for (int i=0; i<n; i++)
+		{
+			int32_t diff = freqs[i] - (freqs[0] + ((int64_t)timestamps[i]) * (freqs[n-1] - freqs[0]) / timestamps[n-1]);
+			int32_t reldiff = 1000 * diff / freqs[0];
+			if (abs(reldiff) > reldiff_max)
+				reldiff_max = abs(reldiff);
+		}
+
+		if (reldiff_max <= best_reldiff)
+		{
+			secondbest_reldiff = best_reldiff;
+			best_reldiff = reldiff_max;
+			best_offset = phase_offset;
+		}
+		else if (reldiff_max <= secondbest_reldiff)
+		{
+			secondbest_reldiff = reldiff_max;
+		}
+	}
+
+	int confidence = 100 * (secondbest_reldiff - best_reldiff) / (best_reldiff+1); // relative difference between best and second best in percent
+	if (confidence > 150)
+		return (best_offset+n-1) % n;
+	else
+		return -1;
+}
+
+uint32_t tacho_estimator_edge(struct tacho_estimator *est, uint32_t timestamp)
+{
+	uint32_t interval = timestamp - est->last_edge;
+	est->last_edge = timestamp;
+
+	if (!est->valid || interval == 0)
+	{
+		// the interval started at a standstill and is meaningless
+		est->valid = true;
+		return 0;
+	}
+
+	put_backlog(est, interval);
+	est->phase = (est->phase+1) % est->n_magnets;
+	int detected_phase = detect_phase(est);
+	if (detected_phase != -1 && detected_phase != est->phase)
+	{
+		//printf("PHASE JUMP DETECTED! expected %d, detected %d\n", est->phase, detected_phase);
+		est->phase = detected_phase;
+	}
+
+	est->frequency_millihertz = distance_to_millihertz(est->distances[est->phase], interval) / est->n_magnets;
+	return interval;
+}
+
+uint32_t tacho_estimator_frequency(struct tacho_estimator *est, uint32_t now)
+{
+	if (!est->valid)
+		return 0;
+
+	uint32_t elapsed = now - est->last_edge;
+	if (elapsed >= TACHO_TIMEOUT_US)
+	{
+		est->valid = false;
+		est->frequency_millihertz = 0;
+	}
+	else if (elapsed > 0)
+	{
+		/* the wheel is slower than the next edge would tell if it arrived now.
+		 * slow down the estimate while waiting for the next edge. */
+		uint32_t bound = distance_to_millihertz(est->distances[(est->phase+1) % est->n_magnets], elapsed) / est->n_magnets;
+		if (bound < est->frequency_millihertz)
+			est->frequency_millihertz = bound;
+	}
+
+	return est->frequency_millihertz;
+}
+
+void tacho_brake_init(struct tacho_brake *brake, int n_magnets)
+{
+	brake->n_magnets = n_magnets;
+	brake->n_edges = 0;
+	brake->last_frequency = 0;
+	brake->last_mid = 0;
+	brake->until = 0;
+	brake->braking = false;
+	brake->onset = 0;
+}
+
+/* Every interval yields a wheel frequency on its own: the fraction of a
+ * revolution that its magnet gap covers is taken from the same gap one
+ * revolution ago, so neither the phase nor the distances are needed. Comparing
+ * it to the previous interval's frequency gives the deceleration right on the
+ * first slower interval, without any smoothing. */
+bool tacho_brake_edge(struct tacho_brake *brake, uint32_t timestamp)
+{
+	const int n = brake->n_magnets;
+
+	for (int i=1; i<n+2; i++)
+		brake->edges[i-1] = brake->edges[i];
+	brake->edges[n+1] = timestamp;
+
+	if (brake->n_edges < n+2)
+	{
+		brake->n_edges++;
+		return false;
+	}
+
+	uint32_t interval = brake->edges[n+1] - brake->edges[n];
+	uint32_t interval_before = brake->edges[1] - brake->edges[0]; // the same magnet gap, one revolution earlier
+	uint32_t revolution = brake->edges[n] - brake->edges[0];
+	if (interval == 0 || revolution == 0)
+		return false;
+	uint32_t frequency = (uint64_t)1000000000 * interval_before / revolution / interval; // millihertz
+	uint32_t mid = brake->edges[n] + interval / 2;
+
+	bool onset = false;
+	if (brake->last_frequency >= BRAKE_MIN_MILLIHERTZ && frequency < brake->last_frequency &&
+		(uint64_t)(brake->last_frequency - frequency) * 1000000 > (uint64_t)BRAKE_DECELERATION_MILLIHERTZ_PER_S * (mid - brake->last_mid))
+	{
+		if (!brake->braking)
+		{
+			brake->braking = true;
+			brake->onset = timestamp;
+			onset = true;
+		}
+		brake->until = timestamp + BRAKE_HOLD_US;
+	}
+
+	brake->last_frequency = frequency;
+	brake->last_mid = mid;
+	return onset;
+}
+
+bool tacho_brake_poll(struct tacho_brake *brake, uint32_t now)
+{
+	if (brake->braking && (int32_t)(now - brake->until) >= 0)
+		brake->braking = false;
+	return brake->braking;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Tacho estimator. Turns the edge timestamps of one hall sensor into a wheel
+ * frequency and detects braking. It is hardware independent; tacho.c feeds it
+ * with captured edges.
+ *
+ * Resources: none
+ *
+ * Usage:
+ *   - tacho_estimator_init(&est, distances, n_magnets);
+ *   - call tacho_estimator_edge(&est, timestamp) for every edge, with a timestamp
+ *     in microseconds
+ *   - tacho_estimator_frequency(&est, now) returns the current estimate
+ *
+ *   - the brake detector is separate, because it runs in another context:
+ *     tacho_brake_init(&brake, n_magnets), then tacho_brake_edge() for every edge
+ *     and tacho_brake_poll() as often as possible.
+ *
+ * Timestamps wrap around after 71 minutes, which is fine as long as no interval
+ * gets that long.
+ */
+
+#define TACHO_MAX_MAGNETS 8
+
+/* distances (see learn.py) are scaled for a timer tick of TACHO_CALIB_PRESCALER
+ * cycles at 72 MHz */
+#define TACHO_CALIB_PRESCALER 1098
+#define TACHO_CALIB_CYCLES_PER_US 72
+
+/* Without an edge for this long, the wheel is considered standing still */
+#define TACHO_TIMEOUT_US 3000000
+
+struct tacho_estimator
+{
+	const uint32_t *distances;
+	int n_magnets;
+
+	bool valid;          // false if the interval since the last edge started at a standstill
+	uint32_t last_edge;  // timestamp of the last edge
+	uint32_t frequency_millihertz;
+	uint32_t backlog[TACHO_MAX_MAGNETS]; // the last n_magnets intervals, oldest first
+	int phase;
+};
+
+struct tacho_brake
+{
+	int n_magnets;
+
+	uint32_t edges[TACHO_MAX_MAGNETS+2]; // timestamps of the last n_magnets+2 edges, oldest first
+	int n_edges;
+	uint32_t last_frequency; // wheel frequency during the previous interval
+	uint32_t last_mid;       // middle of the previous interval
+	uint32_t until;
+	bool braking;
+	uint32_t onset;          // timestamp of the edge that started braking
+};
+
+void tacho_estimator_init(struct tacho_estimator *est, const uint32_t *distances, int n_magnets);
+
+/** Processes one edge. Returns the interval since the previous edge in
+  * microseconds, or 0 if there was none (after a standstill). */
+uint32_t tacho_estimator_edge(struct tacho_estimator *est, uint32_t timestamp);
+
+/** Returns the wheel frequency in millihertz at time `now`. While no new edge
+  * comes, the estimate decays, and drops to 0 after TACHO_TIMEOUT_US. */
+uint32_t tacho_estimator_frequency(struct tacho_estimator *est, uint32_t now);
+
+void tacho_brake_init(struct tacho_brake *brake, int n_magnets);
+
+/** Processes one edge. Returns true if it started braking. */
+bool tacho_brake_edge(struct tacho_brake *brake, uint32_t timestamp);
+
+/** Returns whether the wheel is braking at time `now` */
+bool tacho_brake_poll(struct tacho_brake *brake, uint32_t now);
@@ -0,0 +1,45 @@
+#include <stdio.h>
+#include "tachotrace.h"
+
+static struct tachotrace_record records[TACHOTRACE_SIZE];
+static uint32_t n_records = 0; // since boot; the newest is at (n_records - 1) % TACHOTRACE_SIZE
+
+static struct tachotrace_record *next_record(void)
+{
+	return &records[n_records++ % TACHOTRACE_SIZE];
+}
+
+void tachotrace_edge(int sensor, uint32_t interval, uint32_t frequency_millihertz, int phase)
+{
+	struct tachotrace_record *r = next_record();
+	r->interval = interval;
+	r->frequency = frequency_millihertz > 0xFFFFFF ? 0xFFFFFF : frequency_millihertz;
+	r->phase = phase;
+	r->sensor = sensor;
+	r->type = TACHOTRACE_EDGE;
+}
+
+void tachotrace_overflow(void)
+{
+	struct tachotrace_record *r = next_record();
+	r->interval = 0;
+	r->frequency = 0;
+	r->phase = 0;
+	r->sensor = 0;
+	r->type = TACHOTRACE_OVERFLOW;
+}
+
+void tachotrace_dump(void)
+{
+	uint32_t first = n_records > TACHOTRACE_SIZE ? n_records - TACHOTRACE_SIZE : 0;
+
+	for (uint32_t i=first; i<n_records; i++)
+	{
+		const struct tachotrace_record *r = &records[i % TACHOTRACE_SIZE];
+		if (r->type == TACHOTRACE_OVERFLOW)
+			printf("trace overflow\n");
+		else
+			printf("trace edge %d %lu %lu %d\n", r->sensor, (unsigned long)r->interval, (unsigned long)r->frequency, r->phase);
+	}
+	printf("trace end %lu %lu\n", (unsigned long)(n_records - first), (unsigned long)first);
+}
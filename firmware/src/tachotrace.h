@@ -0,0 +1,43 @@
+#pragma once
+#include <stdint.h>
+
+/* Tacho trace module: records the tacho edges in RAM, for ../host/tacho_replay.c
+ *
+ * Resources: TACHOTRACE_SIZE * 8 bytes of RAM, only in 'make TACHO_TRACE=1' builds
+ *
+ * Every edge is recorded with its interval and the estimator's output after it
+ * (frequency and phase), so a replay can check that it runs the same code as the
+ * firmware. Overflows are the calls of tacho_update() that came so late that TIM1
+ * wrapped unnoticed; the timestamps of their edges are off by multiples of 65ms.
+ * The ring keeps the newest records: 256 records are about 50 wheel revolutions
+ * with 5 magnets.
+ *
+ * Usage:
+ *   - tachotrace_edge() for every edge, tachotrace_overflow() for every overflow
+ *   - tachotrace_dump() prints the records, oldest first, as
+ *       "trace edge <sensor> <interval us> <frequency mHz> <phase>"
+ *       "trace overflow"
+ *       "trace end <records> <lost>"
+ *     tacho.c prints "trace distances <sensor> <distance>..." before them.
+ */
+
+#ifndef TACHOTRACE_SIZE
+#define TACHOTRACE_SIZE 256
+#endif
+
+enum tachotrace_type { TACHOTRACE_EDGE, TACHOTRACE_OVERFLOW };
+
+struct tachotrace_record
+{
+	uint32_t interval;       // microseconds since the previous edge, 0 after a standstill
+	unsigned frequency : 24; // millihertz, the estimate after this edge
+	unsigned phase : 4;
+	unsigned sensor : 2;
+	unsigned type : 2;       // enum tachotrace_type
+};
+
+void tachotrace_edge(int sensor, uint32_t interval, uint32_t frequency_millihertz, int phase);
+void tachotrace_overflow(void);
+
+/** Prints all records. Nothing may be recorded meanwhile. */
+void tachotrace_dump(void);
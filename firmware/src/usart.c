@@ -17,11 +17,18 @@
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/usart.h>
+#include <libopencm3/cm3/nvic.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <errno.h>
 #include "usart.h"
 
+#define BAUDRATE 115200
+
+static char line[UART_LINE_MAX + 1];
+static int line_length = 0;        // -1 while a too long line is being dropped
+static volatile bool line_ready = false;
+
 void uart_setup(void)
 {
 	rcc_periph_clock_enable(RCC_GPIOA);
@@ -30,14 +37,20 @@ void uart_setup(void)
 
 	/* setup GPIO: tx on PA9 */
 	gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_50_MHZ, GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, GPIO9); // TX pin
+	gpio_set_mode(GPIOA, GPIO_MODE_INPUT, GPIO_CNF_INPUT_FLOAT, GPIO10); // RX pin
 
         /* Setup UART parameters. */
-	usart_set_baudrate(USART1, 115200);
+	usart_set_baudrate(USART1, BAUDRATE);
 	usart_set_databits(USART1, 8);
 	usart_set_stopbits(USART1, USART_STOPBITS_1);
 	usart_set_parity(USART1, USART_PARITY_NONE);
 	usart_set_flow_control(USART1, USART_FLOWCONTROL_NONE);
-	usart_set_mode(USART1, USART_MODE_TX); // no tx for now
+	usart_set_mode(USART1, USART_MODE_TX_RX);
+
+	// below the WS2812 driver, above the renderer: a character arrives every 87us
+	nvic_set_priority(NVIC_USART1_IRQ, 0x8 << 4);
+	nvic_enable_irq(NVIC_USART1_IRQ);
+	usart_enable_rx_interrupt(USART1);
 
 	/* Finally enable the USART. */
 	usart_enable(USART1);
@@ -45,6 +58,52 @@ void uart_setup(void)
 	printf("Hello world!\n");
 }
 
+void uart_flush(void)
+{
+	while (!usart_get_flag(USART1, USART_SR_TC));
+}
+
+void uart_retime(void)
+{
+	// uses rcc_apb2_frequency, which clock_set() updates
+	usart_set_baudrate(USART1, BAUDRATE);
+}
+
+void usart1_isr(void)
+{
+	if (!usart_get_flag(USART1, USART_SR_RXNE))
+		return;
+	char c = usart_recv(USART1); // clears RXNE
+
+	if (line_ready)
+		return;
+	if (c == '\r' || c == '\n')
+	{
+		if (line_length > 0)
+		{
+			line[line_length] = '\0';
+			line_ready = true;
+		}
+		line_length = 0;
+	}
+	else if (line_length >= 0)
+	{
+		line[line_length++] = c;
+		if (line_length > UART_LINE_MAX)
+			line_length = -1;
+	}
+}
+
+const char *uart_line(void)
+{
+	return line_ready ? line : NULL;
+}
+
+void uart_line_done(void)
+{
+	line_ready = false;
+}
+
 // allow printf() to use the USART
 int _write(int file, char *ptr, int len)
 {
@@ -1,10 +1,30 @@
 #pragma once
 
+#include <stdbool.h>
+
 /* USART module
+ *
+ * Resources: USART1 (TX on PA9, RX on PA10, which tacho CH3 would need as well), its IRQ
+ *
  * Usage:
  *   - call uart_setup();
  *   - use printf()
+ *   - poll uart_line() for received lines, call uart_line_done() when done with one
  */
 
+/** Longest line that can be received, without the line break. Longer lines are dropped. */
+#define UART_LINE_MAX 560
+
 void uart_setup(void);
+
+/** Waits until the last character has been sent. Call before a clock switch. */
+void uart_flush(void);
+
+/** Sets the baud rate again for the current clock. Call after a clock switch. */
+void uart_retime(void);
+/** Returns the last received line (without the line break), or NULL. Further
+  * characters are dropped until uart_line_done() is called. */
+const char *uart_line(void);
+void uart_line_done(void);
+
 int _write(int file, char *ptr, int len);
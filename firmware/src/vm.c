@@ -0,0 +1,189 @@
+#include <stddef.h>
+#include "vm.h"
+#include "math.h"
+#include "noise.h"
+#include "color.h"
+#include "palette.h"
+
+/* VM_PALETTE operands */
+static const struct palette * const palettes[] = { &palette_rainbow, &palette_lava, &palette_water };
+#define N_PALETTES ((int)(sizeof(palettes) / sizeof(*palettes)))
+
+/* stack effect and operand size of every op, for vm_check() */
+struct op_info
+{
+	int8_t pops;
+	int8_t pushes;
+	int8_t operand; // bytes
+};
+
+static const struct op_info ops[VM_N_OPS] = {
+	[VM_I] = { 0, 1, 0 }, [VM_T] = { 0, 1, 0 }, [VM_POS] = { 0, 1, 0 }, [VM_VEL] = { 0, 1, 0 }, [VM_BRIGHT] = { 0, 1, 0 },
+	[VM_CONST] = { 0, 1, 4 },
+	[VM_LOAD] = { 0, 1, 1 }, [VM_STORE] = { 1, 0, 1 },
+	[VM_ADD] = { 2, 1, 0 }, [VM_SUB] = { 2, 1, 0 }, [VM_MUL] = { 2, 1, 0 }, [VM_DIV] = { 2, 1, 0 },
+	[VM_MIN] = { 2, 1, 0 }, [VM_MAX] = { 2, 1, 0 },
+	[VM_ADDK] = { 1, 1, 4 }, [VM_MULK] = { 1, 1, 4 },
+	[VM_NEG] = { 1, 1, 0 }, [VM_ABS] = { 1, 1, 0 }, [VM_FRAC] = { 1, 1, 0 }, [VM_CLAMP] = { 1, 1, 0 },
+	[VM_SIN] = { 1, 1, 0 },
+	[VM_NOISE] = { 2, 1, 0 },
+	[VM_SNAKE] = { 4, 1, 0 },
+	[VM_HSV] = { 3, 1, 0 },
+	[VM_PALETTE] = { 1, 1, 1 },
+	[VM_SCALE] = { 2, 1, 0 },
+};
+
+static int section_length(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static int32_t operand32(const uint8_t *p)
+{
+	return (int32_t)((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+/** Checks one section. depth: the stack depth it must leave, palette: the palette used
+  * so far or -1. Returns NULL or an error. */
+static const char *check_section(const uint8_t *code, int length, int depth, int *palette)
+{
+	int sp = 0;
+
+	for (int pc=0; pc<length; )
+	{
+		uint8_t op = code[pc++];
+		if (op >= VM_N_OPS)
+			return "invalid op";
+		if (pc + ops[op].operand > length)
+			return "truncated operand";
+		if (sp < ops[op].pops)
+			return "stack underflow";
+		sp += ops[op].pushes - ops[op].pops;
+		if (sp > VM_STACK)
+			return "stack overflow";
+
+		if ((op == VM_LOAD || op == VM_STORE) && code[pc] >= VM_REGS)
+			return "invalid register";
+		if (op == VM_PALETTE)
+		{
+			if (code[pc] >= N_PALETTES)
+				return "invalid palette";
+			// palette_use() shares one table, switching per LED would rebuild it every time
+			if (*palette >= 0 && *palette != code[pc])
+				return "more than one palette";
+			*palette = code[pc];
+		}
+		pc += ops[op].operand;
+	}
+
+	return sp == depth ? NULL : "wrong stack depth at the end";
+}
+
+const char *vm_check(const uint8_t *program, int size)
+{
+	if (size < VM_HEADER || program[0] != 'V')
+		return "not a program";
+	if (program[1] != VM_VERSION)
+		return "wrong version";
+
+	int frame_length = section_length(&program[2]);
+	int led_length = section_length(&program[4]);
+	if (VM_HEADER + frame_length + led_length != size || size > VM_MAX_PROGRAM)
+		return "wrong size";
+
+	int palette = -1;
+	const char *error = check_section(&program[VM_HEADER], frame_length, 0, &palette);
+	if (error)
+		return error;
+	return check_section(&program[VM_HEADER + frame_length], led_length, 1, &palette);
+}
+
+static int32_t snake(int32_t x, int32_t head, int32_t len, int32_t fade)
+{
+	// 64 bit: head + len may lie outside the 32 bit range
+	int64_t end = (int64_t)head + len;
+	if (x < head || x > end)
+		return 0;
+	int64_t dist = x - (int64_t)head < end - x ? x - (int64_t)head : end - x;
+	if (fade <= 0)
+		return ONE;
+	return min(((int64_t)dist << SHIFT) / fade, ONE);
+}
+
+/** Runs a checked section and returns what it leaves on the stack. inputs: I, T, POS, VEL, BRIGHT. */
+static int32_t execute(const uint8_t *pc, const uint8_t *end, int32_t regs[], const int32_t inputs[])
+{
+	int32_t stack[VM_STACK + 1] = { 0 };
+	int32_t *sp = stack; // points at the top value, stack[0] is only read by an empty section
+	int32_t a;
+
+	while (pc < end)
+	{
+		switch (*pc++)
+		{
+			case VM_I: *++sp = inputs[0]; break;
+			case VM_T: *++sp = inputs[1]; break;
+			case VM_POS: *++sp = inputs[2]; break;
+			case VM_VEL: *++sp = inputs[3]; break;
+			case VM_BRIGHT: *++sp = inputs[4]; break;
+			case VM_CONST: *++sp = operand32(pc); pc += 4; break;
+			case VM_LOAD: *++sp = regs[*pc++]; break;
+			case VM_STORE: regs[*pc++] = *sp--; break;
+
+			case VM_ADD: a = *sp--; *sp = (int32_t)((uint32_t)*sp + (uint32_t)a); break;
+			case VM_SUB: a = *sp--; *sp = (int32_t)((uint32_t)*sp - (uint32_t)a); break;
+			case VM_MUL: a = *sp--; *sp = ((int64_t)*sp * a) >> SHIFT; break;
+			case VM_DIV: a = *sp--; *sp = a ? ((int64_t)*sp << SHIFT) / a : 0; break;
+			case VM_MIN: a = *sp--; *sp = min(*sp, a); break;
+			case VM_MAX: a = *sp--; *sp = max(*sp, a); break;
+			case VM_ADDK: *sp = (int32_t)((uint32_t)*sp + (uint32_t)operand32(pc)); pc += 4; break;
+			case VM_MULK: *sp = ((int64_t)*sp * operand32(pc)) >> SHIFT; pc += 4; break;
+
+			case VM_NEG: *sp = (int32_t)-(uint32_t)*sp; break;
+			case VM_ABS: *sp = *sp < 0 ? (int32_t)-(uint32_t)*sp : *sp; break;
+			case VM_FRAC: *sp &= ONE - 1; break;
+			case VM_CLAMP: *sp = clamp(*sp, 0, ONE); break;
+			case VM_SIN: *sp = sini((uint32_t)*sp >> (SHIFT - 12)); break;
+			case VM_NOISE: a = *sp--; *sp = gnoise_fractal(*sp, a, 3); break;
+			case VM_SNAKE: sp -= 3; *sp = snake(sp[0], sp[1], sp[2], sp[3]); break;
+
+			case VM_HSV:
+				sp -= 2;
+				*sp = hsv2(((uint32_t)(sp[0] & (ONE - 1)) * 3600) >> SHIFT,
+					(clamp(sp[1], 0, ONE) * 1000) >> SHIFT, (clamp(sp[2], 0, ONE) * 1000) >> SHIFT);
+				break;
+			case VM_PALETTE:
+				*sp = palette_lerp(palette_use(palettes[*pc++]), ((*sp & (ONE - 1)) * 255) >> 8);
+				break;
+			case VM_SCALE: a = *sp--; *sp = palette_scale(*sp, clamp(a, 0, ONE) >> 8); break;
+		}
+	}
+
+	return *sp;
+}
+
+void vm_run(const uint8_t *program, volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity, int brightness)
+{
+	int32_t regs[VM_REGS] = { 0 };
+	int32_t inputs[5] = {
+		0,
+		(int64_t)t * ONE / FPS,
+		(int32_t)(uint32_t)pos0, // modulo 65536 units, see vm.h
+		(int32_t)velocity,
+		brightness * ONE / 1000
+	};
+
+	const uint8_t *frame = &program[VM_HEADER];
+	const uint8_t *led = frame + section_length(&program[2]);
+	const uint8_t *end = led + section_length(&program[4]);
+
+	execute(frame, led, regs, inputs);
+
+	for (int i=0; i<N_BOTTOM; i++)
+	{
+		inputs[0] = i << SHIFT;
+		uint32_t color = execute(led, end, regs, inputs) & 0xFFFFFF;
+		led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM-1-i] = color;
+		led_data[N_SIDE+N_FRONT+N_SIDE+N_BOTTOM+i] = color;
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <stdint.h>
+#include "common.h"
+
+/* Pattern VM module: bottom patterns as bytecode, loadable at runtime.
+ *
+ * Resources: none
+ *
+ * A program computes the colour of one LED of the bottom strips from a few
+ * inputs, as a stack machine on 16.16 fixed point values. It consists of two
+ * sections: the frame section runs once per frame and stores values that do
+ * not depend on the LED (e.g. sin(t)) in registers, the LED section runs for
+ * every LED and leaves its colour (0x00GGRRBB) on the stack. The compiler,
+ * ../host/vmc.py, moves everything it can into the frame section.
+ *
+ * Programs are checked once by vm_check(): afterwards every opcode, register
+ * and palette is known to be valid and the stack cannot overflow, so the
+ * interpreter does not check anything per instruction.
+ *
+ * Program layout (little endian):
+ *   'V', VM_VERSION, frame section length (16 bit), LED section length (16 bit),
+ *   frame section, LED section
+ *
+ * Inputs, all 16.16:
+ *   I       LED index, 0 at the rear end of the strips
+ *   T       time in seconds (wraps after 9 hours)
+ *   POS     pos0 in LED units modulo 65536 (1.1 km), see below
+ *   VEL     speed in LED units per second
+ *   BRIGHT  the user's brightness, 0..1
+ *
+ * POS is the position modulo 65536 LED units, the period of the noise. Like
+ * all values it wraps around: it reads negative from 32768 units on. At the
+ * wrap POS jumps by 65536 units and POS times a constant by a whole number of
+ * units, so FRAC, SIN, PALETTE and HSV of sums and multiples of POS continue
+ * seamlessly. NOISE only does if POS is scaled by an integer; DIV, MIN, MAX,
+ * CLAMP and SNAKE of POS see the jump.
+ *
+ * Usage:
+ *   - vm_check(program, size) once, it returns NULL or an error message
+ *   - vm_run(program, led_data, t, pos0, velocity, brightness) once per frame
+ */
+
+#define VM_VERSION 1
+#define VM_HEADER 6
+#define VM_MAX_PROGRAM 256
+#define VM_STACK 16
+#define VM_REGS 16
+/** Number of programs that can be stored, see vmstore.h */
+#define VM_SLOTS 2
+
+enum vm_op
+{
+	/* operands: none. push an input */
+	VM_I, VM_T, VM_POS, VM_VEL, VM_BRIGHT,
+	/* operand: 32 bit constant */
+	VM_CONST,
+	/* operand: register */
+	VM_LOAD, VM_STORE,
+	/* binary: pop b, pop a, push a op b. Results wrap around at the 32 bit range */
+	VM_ADD, VM_SUB, VM_MUL, VM_DIV, VM_MIN, VM_MAX,
+	/* operand: 32 bit constant k. a op k, saves the VM_CONST */
+	VM_ADDK, VM_MULK,
+	/* unary */
+	VM_NEG, VM_ABS,
+	VM_FRAC,    // a - floor(a)
+	VM_CLAMP,   // a clamped to 0..1
+	VM_SIN,     // sin(2 pi a), i.e. one period per unit
+	VM_NOISE,   // pop y, pop x, push gradient noise (3 octaves), -1..1
+	VM_SNAKE,   // pop fade, pop len, pop head, pop x: 0..1 inside head..head+len, fading in over fade
+	/* colours */
+	VM_HSV,     // pop v, pop s, pop h: hsv2() with h in turns, s and v 0..1
+	VM_PALETTE, // operand: palette (see vm.c). a in 0..1 (wraps) -> colour
+	VM_SCALE,   // pop v, pop colour: colour * v (0..1)
+	VM_N_OPS
+};
+
+/** Returns NULL if the program can be run, an error message otherwise */
+const char *vm_check(const uint8_t *program, int size);
+
+/** Runs a checked program for all LEDs of the bottom strips */
+void vm_run(const uint8_t *program, volatile uint32_t led_data[], int t, fixed_t pos0, fixed_t velocity, int brightness);
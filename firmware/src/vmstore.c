@@ -0,0 +1,39 @@
+#include <libopencm3/stm32/flash.h>
+#include <stddef.h>
+#include "vm.h"
+#include "vmstore.h"
+
+static const uint8_t *slot_address(int slot)
+{
+	return (const uint8_t *)(VMSTORE_BASE + slot * VMSTORE_PAGE);
+}
+
+const uint8_t *vmstore_program(int slot)
+{
+	const uint8_t *program = slot_address(slot);
+	int size = VM_HEADER + (program[2] | (program[3] << 8)) + (program[4] | (program[5] << 8));
+
+	// an erased page reads 0xFF, which vm_check() rejects
+	if (vm_check(program, size))
+		return NULL;
+	return program;
+}
+
+bool vmstore_write(int slot, const uint8_t *program, int size)
+{
+	uint32_t address = (uint32_t)slot_address(slot);
+
+	flash_unlock();
+	flash_erase_page(address);
+	for (int i=0; i<size; i+=2)
+	{
+		uint16_t half = program[i] | ((i + 1 < size ? program[i+1] : 0xFF) << 8);
+		flash_program_half_word(address + i, half);
+	}
+	flash_lock();
+
+	for (int i=0; i<size; i++)
+		if (slot_address(slot)[i] != program[i])
+			return false;
+	return true;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/* VM store module: keeps the programs of the vm patterns in flash.
+ *
+ * Resources: the last VM_SLOTS pages (1 KiB each) of the flash, which budget.cfg
+ * keeps free of code
+ *
+ * Erasing a page stalls the CPU for some 20 ms, including every interrupt that
+ * runs from flash. The caller must stop the renderer and the WS2812 driver first.
+ *
+ * Usage:
+ *   - vmstore_program(slot) at boot, NULL if the slot holds no valid program
+ *   - stop the renderer and ws2812, vmstore_write(slot, program, size), restart them
+ */
+
+#define VMSTORE_PAGE 1024
+#define VMSTORE_BASE (0x08000000 + 65536 - VM_SLOTS * VMSTORE_PAGE)
+
+/** Returns the program in a slot, or NULL if it is empty or does not pass vm_check() */
+const uint8_t *vmstore_program(int slot);
+
+/** Replaces the program in a slot. Returns false if the flash could not be written. */
+bool vmstore_write(int slot, const uint8_t *program, int size);
@@ -28,27 +28,57 @@
 #include <libopencm3/cm3/nvic.h>
 #include <libopencm3/stm32/timer.h>
 #include <libopencm3/stm32/usart.h>
+#ifdef BENCH
+#include <libopencm3/cm3/dwt.h>
+#endif
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
 
 #include "ws2812.h"
+#include "clock.h"
+#include "tacho.h"
+#include "common.h"
+#include "output.h"
+#include "powerlimit.h"
+#include "sensors.h"
 
 
 // minimum ID offset is 0x100 (first ID byte mustn't be 0x00)
 #define ID_OFFSET 0xA000
 
-#define TICK_NS (1000/72)
-#define WS0 (350 / TICK_NS)
-#define WS1 (800 / TICK_NS)
-#define WSP (1300 / TICK_NS)
-#define WSL (20000 / TICK_NS)
+/* bit timings in ns. set_timing() converts them to timer ticks at the current clock. */
+#define WS0_NS 350
+#define WS1_NS 800
+#define WSP_NS 1300
+static uint8_t ws0, ws1;
+static uint16_t wsp;
 
 #define DMA_BANK_SIZE 40 * 8 * 3
 #define DMA_SIZE (DMA_BANK_SIZE*2)
 static uint8_t dma_data[DMA_SIZE];
 volatile uint32_t led_data[LED_COUNT];
 static volatile uint32_t led_cur = 0;
+/* the part of each LED channel that has not been sent yet, see output.h */
+static uint8_t dither_remainder[LED_COUNT][3];
+/* the estimated current of the refresh being sent, see powerlimit.h */
+static uint32_t current_fixed = 0;
+static uint32_t current_scaled = 0;
+
+/* time from writing a bank until its last bit is out, in microseconds */
+#define DMA_BANK_US (2 * DMA_BANK_SIZE * WSP_NS / 1000)
+#define BOTTOM_FIRST (N_SIDE+N_FRONT+N_SIDE)
+#define BOTTOM_END (BOTTOM_FIRST+2*N_BOTTOM)
+
+static bool brake_active = false;
+static bool brake_override = false;
+static bool brake_latency_pending = false;
+volatile ws2812_refresh_hook_t ws2812_refresh_hook = NULL;
+volatile bool ws2812_brake_frame_ready = false;
+volatile uint32_t ws2812_brake_latency_us = 0;
+#ifdef BENCH
+volatile uint32_t ws2812_isr_cycles_max = 0;
+#endif
 
 
 static void ws2812_clock_setup(void)
@@ -59,6 +89,13 @@ static void ws2812_clock_setup(void)
 	rcc_periph_clock_enable(RCC_AFIO);
 }
 
+static void set_timing(void)
+{
+	ws0 = WS0_NS * clock_mhz / 1000;
+	ws1 = WS1_NS * clock_mhz / 1000;
+	wsp = WSP_NS * clock_mhz / 1000;
+}
+
 static void pwm_setup(void) {
 	/* Configure GPIOs: OUT=PA7 */
 	gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_50_MHZ,
@@ -81,7 +118,7 @@ static void pwm_setup(void) {
 
 	timer_enable_preload(TIM3);
 	timer_continuous_mode(TIM3);
-	timer_set_period(TIM3, WSP);
+	timer_set_period(TIM3, wsp);
 
 	timer_enable_counter(TIM3);
 }
@@ -91,13 +128,37 @@ static void pwm_setup(void) {
 static void populate_dma_data(uint8_t *dma_data_bank) {
 	for(int i=0; i<DMA_BANK_SIZE;) {
 		led_cur = led_cur % (LED_COUNT+3);
+		if (led_cur == 0 && ws2812_refresh_hook)
+			ws2812_refresh_hook();
 		if(led_cur < LED_COUNT) {
-			uint32_t v = led_data[led_cur];
+			const struct output_lut *lut = output_lut_led(led_cur);
+			uint32_t color = led_data[led_cur];
+			if (brake_active && led_cur >= BOTTOM_FIRST && led_cur < BOTTOM_END) {
+				// the brake light is not dimmed by the global brightness
+				lut = &output_lut_front;
+				if (brake_override)
+					color = BRAKE_COLOR;
+				if (brake_override && brake_latency_pending) {
+					ws2812_brake_latency_us = tacho_brake_now() - tacho_brake_onset + DMA_BANK_US;
+					brake_latency_pending = false;
+				}
+			}
+			uint32_t v = output_dither(lut, color, dither_remainder[led_cur]);
+			if (lut == output_lut_bottom)
+				current_scaled += powerlimit_led_current(v);
+			else
+				current_fixed += powerlimit_led_current(v);
 			for(int j=0; j<24; j++) {
-				dma_data_bank[i++] = (v & 0x800000) ? WS1 : WS0;
+				dma_data_bank[i++] = (v & 0x800000) ? ws1 : ws0;
 				v <<= 1;
 			}
 		} else {
+			if (led_cur == LED_COUNT) {
+				// the refresh is complete
+				sensors_publish_led_current(powerlimit_ma(current_fixed, LED_COUNT), powerlimit_ma(current_scaled, 0));
+				current_fixed = 0;
+				current_scaled = 0;
+			}
 			for(int j=0; j<24; j++) {
 				dma_data_bank[i++] = 0;
 			}
@@ -136,8 +197,24 @@ static int timer_dma(uint8_t *tx_buf, int tx_len)
 	return 0;
 }
 
+/** Lights the bottom strips as soon as the brake detector fires, until the
+  * renderer has drawn its brake pattern into led_data */
+static void poll_brake(void)
+{
+	bool braking = tacho_poll_brake();
+	if (braking && !brake_override && !ws2812_brake_frame_ready)
+		brake_latency_pending = true;
+	if (!braking)
+		ws2812_brake_frame_ready = false;
+	brake_override = braking && !ws2812_brake_frame_ready;
+	brake_active = braking;
+}
+
 void dma1_channel3_isr(void)
 {
+#ifdef BENCH
+	uint32_t start = dwt_read_cycle_counter();
+#endif
 	if ((DMA1_ISR & DMA_ISR_TCIF3) != 0) {
 		DMA1_IFCR |= DMA_IFCR_CTCIF3;
 		populate_dma_data(&dma_data[DMA_BANK_SIZE]);
@@ -146,12 +223,46 @@ void dma1_channel3_isr(void)
 		DMA1_IFCR |= DMA_IFCR_CHTIF3;
 		populate_dma_data(dma_data);
 	}
+	// after the refill, which has to meet the DMA: a detection reaches the next bank
+	poll_brake();
+#ifdef BENCH
+	uint32_t cycles = dwt_read_cycle_counter() - start;
+	if (cycles > ws2812_isr_cycles_max)
+		ws2812_isr_cycles_max = cycles;
+#endif
+}
+
+void ws2812_stop(void)
+{
+	// force the line low first, so that no LED sees a partial bit
+	timer_set_oc_mode(TIM3, TIM_OC2, TIM_OCM_FORCE_LOW);
+	timer_disable_counter(TIM3);
+	dma_disable_channel(DMA1, DMA_CHANNEL3);
+}
+
+void ws2812_start(void)
+{
+	// the clock may have changed meanwhile
+	set_timing();
+	timer_set_period(TIM3, wsp);
+	timer_generate_event(TIM3, TIM_EGR_UG);
+
+	// start with a complete refresh
+	led_cur = 0;
+	current_fixed = 0;
+	current_scaled = 0;
+	populate_dma_data(dma_data);
+	populate_dma_data(&dma_data[DMA_BANK_SIZE]);
+	timer_dma(dma_data, DMA_SIZE);
+	timer_set_oc_mode(TIM3, TIM_OC2, TIM_OCM_PWM1);
+	timer_enable_counter(TIM3);
 }
 
 void ws2812_init(void)
 {
 	ws2812_clock_setup();
 	
+	set_timing();
 	memset(dma_data, 0, DMA_SIZE);
 	memset((void*)led_data, 0, LED_COUNT*sizeof(*led_data));
 	for (int i=0; i<LED_COUNT; i++)
@@ -3,6 +3,7 @@
 
 #pragma once
 #include <stdint.h>
+#include <stdbool.h>
 
 /* WS2812 driver.
  *
@@ -15,7 +16,15 @@
  *  - Connect the DIN pin of the wWS2812 strip to PA7.
  *  - Call ws2812_init();
  *  - Then update the led_data array as needed
- *  - Data format: (red << 8) | (green << 16) | (blue)
+ *  - Data format: (red << 8) | (green << 16) | (blue), before gamma correction.
+ *    Every LED is mapped through the output stage (see output.h) while sending,
+ *    and dithered over the refreshes between two frames.
+ *
+ * If ws2812_refresh_hook is set, it is called from the DMA interrupt before the
+ * first LED of every refresh is encoded, and may update led_data.
+ *
+ * When the tacho's brake detector fires, the bottom strips are sent as BRAKE_COLOR
+ * from the next DMA bank on, until the renderer sets ws2812_brake_frame_ready.
  */
 
 // maximum is at about 4000
@@ -23,4 +32,27 @@
 
 extern volatile uint32_t led_data[LED_COUNT];
 
+typedef void (*ws2812_refresh_hook_t)(void);
+extern volatile ws2812_refresh_hook_t ws2812_refresh_hook;
+
+/** Set by the renderer once led_data contains a brake pattern */
+extern volatile bool ws2812_brake_frame_ready;
+
+/** Time from the last brake onset edge until its pixels were sent, in microseconds.
+  * This is an upper bound, as it assumes the pixel was sent last in its DMA bank.
+  * 'make BENCH=1' builds print it on every braking. */
+extern volatile uint32_t ws2812_brake_latency_us;
+
+#ifdef BENCH
+/** Longest DMA interrupt so far, in cycles. Includes the encoding of one bank
+  * (40 LEDs, with dithering), the brake detector and the refresh hook. */
+extern volatile uint32_t ws2812_isr_cycles_max;
+#endif
+
 void ws2812_init(void);
+
+/** Stops sending with the data line low. The LEDs keep the last refresh. */
+void ws2812_stop(void);
+
+/** Resumes sending after ws2812_stop(), with the bit timing for the current clock */
+void ws2812_start(void);